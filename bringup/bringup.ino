@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include "vs23s0x0.h"
+#include "vs23s0x0-fixed.h"
 
 /*
  * TMS9918 RGB colors
@@ -64,6 +65,11 @@ enum colorid
 //uint8_t plasma[256][200];
 
 VS23S0x0 vs23;
+
+// The mode setup() starts (mode 4, PAL, lowpass) as a fixed-mode
+// driver, timed against vs23 below.
+typedef VS23S0x0Fixed<VS23Mode<256, 224, 32, 20, 6, 8, 15000000>, true, true>
+  FixedMode;
 static const byte CH0	= 0x00;
 static const byte CH1	= 0x01;
 static const byte CH2	= 0x02;
@@ -100,6 +106,61 @@ static void Mandelbrot (uint8_t channel, float Xn, float Xp, float Yn, float Yp)
 }
 
 
+static inline uint32_t
+cycles ()
+{
+  return aux_reg_read (ARC_V2_TMR1_COUNT);
+}
+
+static void
+printPerPixel (const __FlashStringHelper *what, uint32_t vs, uint32_t fixed,
+	       uint32_t pixels)
+{
+  Serial.print (what);
+  Serial.print (F(" [cycles/pixel] VS23S0x0 "));
+  Serial.print ((float)vs / pixels, 2);
+  Serial.print (F(", fixed "));
+  Serial.println ((float)fixed / pixels, 2);
+}
+
+// Time per pixel and per line drawing of VS23S0x0 against
+// VS23S0x0Fixed, same pixels through both.
+static void
+compareFixed ()
+{
+  uint32_t pixels = (uint32_t)FixedMode::width() * FixedMode::height();
+  uint32_t t0, t1, t2, t3, t4;
+  uint16_t x, y;
+
+  if (!FixedMode::begin (vs23))
+    {
+      Serial.println (F("Fixed mode does not match, not timed"));
+      return;
+    }
+  vs23.waitReady();
+  // Calibration leaves the cycle counter running.
+  vs23.cyclesPerFrame();
+
+  t0 = cycles();
+  for (y = 0; y < FixedMode::height(); y++)
+    for (x = 0; x < FixedMode::width(); x++)
+      vs23.setPixelYuv (x, y, x ^ y);
+  t1 = cycles();
+  for (y = 0; y < FixedMode::height(); y++)
+    for (x = 0; x < FixedMode::width(); x++)
+      FixedMode::setPixelYuv (x, y, x ^ y);
+  t2 = cycles();
+  for (y = 0; y < FixedMode::height(); y++)
+    vs23.drawHSpan (0, y, FixedMode::width(), y);
+  t3 = cycles();
+  for (y = 0; y < FixedMode::height(); y++)
+    FixedMode::drawHLine (0, y, FixedMode::width(), y);
+  t4 = cycles();
+
+  printPerPixel (F("setPixelYuv"), t1 - t0, t2 - t1, pixels);
+  printPerPixel (F("Line spans "), t3 - t2, t4 - t3, pixels);
+}
+
 void setup() {
 
   // Wait for serial interface to come up.
@@ -128,13 +189,43 @@ void setup() {
   SPI.setBitOrder (MSBFIRST) ;
 
   // Setup VS23S0x0 chip
+  unsigned long start = millis();
   vs23.begin(false, true, 1);
+  vs23.waitReady();
 
   Serial.println (F("Configuration done."));
+  Serial.print (F("Time to first frame [msec]: "));
+  Serial.println (millis() - start);
+
+  compareFixed();
+}
+
+#ifdef DEBUG
+// Only horizontal and vertical lines, which is all the test picture
+// draws.
+static void
+drawLine (uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, uint8_t color)
+{
+  if (y0 == y1)
+    vs23.drawHSpan (min (x0, x1), y0, abs (x1 - x0) + 1, color);
+  else
+    vs23.drawVSpan (x0, min (y0, y1), abs (y1 - y0) + 1, color);
+}
+
+static void
+drawLineRgb (uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1,
+	     uint8_t r, uint8_t g, uint8_t b)
+{
+  for (uint16_t y = min (y0, y1); y <= max (y0, y1); y++)
+    for (uint16_t x = min (x0, x1); x <= max (x0, x1); x++)
+      vs23.setPixelRgb (x, y, r, g, b);
 }
+#endif
 
 // the loop function runs over and over again forever
 void loop() {
+  int i,j;
+
 #ifdef DEBUG
   // Draw some color bars
   {
@@ -158,20 +249,25 @@ void loop() {
     re = 0;
     gr = 255;
     bl = 0;
-    drawLineRgb(0, 0, 0, PICY - 1, re, gr, bl);
-    drawLineRgb(0, 0, PICX - 1, 0, re, gr, bl);
-    drawLineRgb(PICX - 1, 0, PICX - 1, PICY - 1, re, gr, bl);
-    drawLineRgb(0, PICY - 1, PICX - 1, PICY - 1, re, gr, bl);
+    drawLineRgb(0, 0, 0, vs23.height() - 1, re, gr, bl);
+    drawLineRgb(0, 0, vs23.width() - 1, 0, re, gr, bl);
+    drawLineRgb(vs23.width() - 1, 0, vs23.width() - 1, vs23.height() - 1,
+		re, gr, bl);
+    drawLineRgb(0, vs23.height() - 1, vs23.width() - 1, vs23.height() - 1,
+		re, gr, bl);
   }
 #endif
 
   uint32_t start_time = 0;
   uint32_t current_time = 0;
-  int i,j;
 
   start_time = millis();
 
+  // Per pixel drawing runs at CPU speed in a shadow frame buffer, if
+  // there is RAM for one.
+  vs23.beginShadow();
   Mandelbrot (CH0, -2.5, 1, -1, 1);
+  vs23.endShadow();
 
   current_time = millis();
 
@@ -267,6 +363,7 @@ void loop() {
 	plasma[x][y] = color;
       }
 #endif
+  vs23.beginShadow();
   while (Serial.available() == 0)
     {
       uint8_t palleteShift = random (0, 255);
@@ -281,7 +378,9 @@ void loop() {
 				color, color*2, 255-color);
 	    }
 	}
+      vs23.present(true);
     }
+  vs23.endShadow();
   Serial.read();
   Serial.println(F("End of test! [Restart press key]"));
   delay(1);
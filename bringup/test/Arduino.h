@@ -0,0 +1,29 @@
+/* Just enough of Arduino.h to build the driver on the host, for the
+   checks in this directory.  Nothing reaches the hardware.  */
+
+#ifndef __ARDUINO_HOST_H__
+#define __ARDUINO_HOST_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+#define ARC_V2_TMR1_COUNT 0x100
+#define ARC_V2_TMR1_CONTROL 0x101
+#define ARC_V2_TMR1_LIMIT 0x102
+
+typedef uint8_t byte;
+
+static inline void digitalWrite (int pin, int value) { (void) pin; (void) value; }
+static inline int digitalRead (int pin) { (void) pin; return LOW; }
+static inline unsigned long micros (void) { return 0; }
+static inline unsigned long millis (void) { return 0; }
+static inline uint32_t aux_reg_read (uint32_t reg) { (void) reg; return 0; }
+static inline void aux_reg_write (uint32_t reg, uint32_t value)
+{ (void) reg; (void) value; }
+
+#endif
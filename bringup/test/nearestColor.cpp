@@ -0,0 +1,131 @@
+/* Host checks of nearestColor and writeLineRgb:
+
+   - nearestIndex must find a palette colour as close as the one the
+     search over all of them finds, for 2M pseudo-random colours, and
+     every palette colour itself;
+   - on a smooth gradient, error diffusion must bring the mean error of
+     each channel down to a couple of steps.
+
+   Build and run from this directory, e.g.
+
+     c++ -O2 -I. -I.. -o nearestColor nearestColor.cpp && ./nearestColor  */
+
+#include <math.h>
+#include <stdio.h>
+
+#include "vs23s0x0.cpp"
+
+#define RANDOM_COLOURS 2000000UL
+#define GRADIENT_W 200
+#define GRADIENT_H 16
+/// Mean error per channel that error diffusion must stay below
+#define GRADIENT_MAX_ERROR 2.0
+
+static uint32_t
+distance (uint8_t index, uint8_t r, uint8_t g, uint8_t b)
+{
+  uint8_t pr = pal[index].rgb >> 16;
+  uint8_t pg = pal[index].rgb >> 8;
+  uint8_t pb = pal[index].rgb;
+  int32_t dy = YRGB(pr, pg, pb) - YRGB(r, g, b);
+  int32_t du = URGB(pr, pg, pb) - URGB(r, g, b);
+  int32_t dv = VRGB(pr, pg, pb) - VRGB(r, g, b);
+
+  return NEAR_Y_WEIGHT * dy * dy + du * du + dv * dv;
+}
+
+static int
+checkNearest (void)
+{
+  uint32_t seed = 1, k, bad = 0;
+  uint16_t i, exact = 0;
+
+  for (k = 0; k < RANDOM_COLOURS; k++)
+    {
+      uint8_t r, g, b, got, want;
+
+      seed = seed * 1103515245 + 12345;
+      r = seed >> 24;
+      g = seed >> 16;
+      b = seed >> 8;
+      got = nearestIndex (r, g, b);
+      want = nearestIndexAll (YRGB(r, g, b), URGB(r, g, b), VRGB(r, g, b));
+      if (distance (got, r, g, b) != distance (want, r, g, b)
+	  && bad++ < 16)
+	printf ("%02x%02x%02x: %02x, want %02x\n", r, g, b, got, want);
+    }
+  for (i = 0; i < PAL_SIZE; i++)
+    {
+      uint32_t c = pal[i].rgb;
+
+      exact += pal[nearestIndex (c >> 16, c >> 8, c)].rgb == c;
+    }
+  printf ("%lu of %lu colours further off than the closest, "
+	  "%u of %u palette colours found\n", (unsigned long) bad,
+	  RANDOM_COLOURS, exact, (unsigned) PAL_SIZE);
+  return bad != 0 || exact != PAL_SIZE;
+}
+
+static int
+checkGradient (void)
+{
+  static uint8_t line[3 * GRADIENT_W];
+  static VS23S0x0 vs;
+  static const char *name[] = { "none", "ordered", "diffusion" };
+  uint8_t *pixels;
+  uint8_t dither;
+  int failed = 0;
+
+  vs.begin (false, true, 1);
+  pixels = (uint8_t *) malloc ((uint32_t) vs.width () * vs.height ());
+  if (!pixels || !vs.beginShadow (pixels))
+    return 1;
+  for (dither = DITHER_NONE; dither <= DITHER_DIFFUSION; dither++)
+    {
+      double error[3] = { 0, 0, 0 };
+      uint16_t x, y;
+      uint8_t c;
+
+      for (y = 0; y < GRADIENT_H; y++)
+	{
+	  for (x = 0; x < GRADIENT_W; x++)
+	    {
+	      line[3 * x] = 40 + x / 4;
+	      line[3 * x + 1] = 90 + x / 8;
+	      line[3 * x + 2] = 30;
+	    }
+	  vs.writeLineRgb (0, y, line, GRADIENT_W, dither);
+	  for (x = 0; x < GRADIENT_W; x++)
+	    {
+	      uint8_t yuv = pixels[(uint32_t) y * vs.width () + x];
+	      uint16_t i;
+
+	      for (i = 0; i < PAL_SIZE && pal[i].yuv != yuv; i++)
+		;
+	      for (c = 0; c < 3; c++)
+		error[c] += (int) (uint8_t) (pal[i].rgb >> (16 - 8 * c))
+		  - line[3 * x + c];
+	    }
+	}
+      printf ("dithering %s: mean error r %.2f g %.2f b %.2f\n",
+	      name[dither], error[0] / (GRADIENT_W * GRADIENT_H),
+	      error[1] / (GRADIENT_W * GRADIENT_H),
+	      error[2] / (GRADIENT_W * GRADIENT_H));
+      if (dither == DITHER_DIFFUSION)
+	for (c = 0; c < 3; c++)
+	  failed |= fabs (error[c] / (GRADIENT_W * GRADIENT_H))
+	    >= GRADIENT_MAX_ERROR;
+    }
+  vs.endShadow ();
+  free (pixels);
+  return failed;
+}
+
+int
+main (void)
+{
+  int failed = checkNearest ();
+
+  failed |= checkGradient ();
+  return failed;
+}
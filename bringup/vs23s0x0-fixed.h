@@ -0,0 +1,197 @@
+#ifndef __VS23S0x0_FIXED_H__
+#define __VS23S0x0_FIXED_H__
+
+#include <SPI.h>
+#include "vs23s0x0.h"
+
+/// SPI and pin access of VS23S0x0Fixed, a class with static inline
+/// members.  This one uses the Arduino SPI library and the pins of
+/// vs_hal.h.
+struct VS23ArduinoHal {
+  static inline void select() {
+    VS23_SELECT;
+  }
+  static inline void deselect() {
+    VS23_DESELECT;
+  }
+  static inline bool blockFinished() {
+    return VS23_MBLOCK == LOW;
+  }
+  static inline uint8_t transfer(uint8_t data) {
+    return SPI.transfer(data);
+  }
+  static inline uint16_t transfer16(uint16_t data) {
+    return SPI.transfer16(data);
+  }
+  static inline void transfer32(uint32_t data) {
+    SPI.transfer32(data);
+  }
+};
+
+/// A video mode as a type, the fields are those of video_mode_t.
+template <uint16_t X, uint16_t Y, uint16_t Top, uint16_t Left,
+	  uint8_t Vclkpp, uint8_t Bextra, uint32_t MaxSpiFreq = 11000000>
+struct VS23Mode {
+  static constexpr uint16_t x = X;
+  static constexpr uint16_t y = Y;
+  static constexpr uint16_t top = Top;
+  static constexpr uint16_t left = Left;
+  static constexpr uint8_t vclkpp = Vclkpp;
+  static constexpr uint8_t bextra = Bextra;
+
+  static const struct video_mode_t *mode() {
+    static const struct video_mode_t m = {
+      X, Y, Top, Left, Vclkpp, Bextra, MaxSpiFreq
+    };
+    return &m;
+  }
+};
+
+/// Drawing for firmware that never changes the mode.  Geometry, pitch
+/// and SRAM layout of the progressive MODE on PAL or NTSC are compile
+/// time constants, worked out as the VS23S0x0 macros do, and the SPI
+/// primitives of HAL inline into the drawing loops.  LOWPASS is the
+/// block mover filter setting, see VS23S0x0::setLowpass.  There is no
+/// state: VS23S0x0 sets up the chip, begin() puts it into MODE, and
+/// all members are static.
+template <class Mode, bool Pal, bool Lowpass = false,
+	  class Hal = VS23ArduinoHal>
+class VS23S0x0Fixed
+{
+ public:
+  static constexpr uint16_t proto_words =
+    (uint16_t)((Pal ? LINE_LENGTH_US_PAL : LINE_LENGTH_US_NTSC)
+	       * (Pal ? XTAL_MHZ_PAL : XTAL_MHZ_NTSC) + 0.5);
+  static constexpr uint32_t index_start =
+    (proto_words * PROTOLINES_PROGRESSIVE + 1UL) / 2 * 4;
+  static constexpr uint16_t total_lines =
+    Pal ? TOTAL_LINES_PROGRESSIVE_PAL : TOTAL_LINES_PROGRESSIVE_NTSC;
+  static constexpr uint32_t first_line = index_start + total_lines * 3UL + 1;
+  static constexpr uint16_t picx =
+    (uint16_t)((Mode::vclkpp * Mode::x / 8) * 8 / Mode::vclkpp);
+#ifndef BYTEPIC
+  static constexpr uint16_t line_bytes = (uint16_t)(picx * PICBITS / 8 + 0.5);
+#else
+  static constexpr uint16_t line_bytes =
+    (uint16_t)(picx * PICBITS / 8 + 0.5 + 1);
+#endif
+  static constexpr uint16_t pitch = line_bytes + Mode::bextra;
+
+  static_assert(first_line + (uint32_t) pitch * Mode::y <= SRAM_SIZE,
+		"the frame buffer does not fit into the SRAM");
+
+  static constexpr uint16_t width() {
+    return Mode::x;
+  }
+
+  static constexpr uint16_t height() {
+    return Mode::y;
+  }
+
+  static constexpr uint32_t pixelAddr(uint16_t x, uint16_t y) {
+    return first_line + (uint32_t) pitch * y + x;
+  }
+
+  // Switch VS to MODE unless it is there already.  False if its layout
+  // is not the one worked out here.
+  static bool begin(VS23S0x0 &vs) {
+    if (!matches(vs))
+      vs.setMode(Mode::mode());
+    return matches(vs);
+  }
+
+  static inline void setPixelYuv(uint16_t x, uint16_t y, uint8_t color) {
+    writeBegin(pixelAddr(x, y));
+    Hal::transfer(color);
+    Hal::deselect();
+  }
+
+  // W pixels from (X, Y) on in one burst.
+  static void drawHLine(uint16_t x, uint16_t y, uint16_t w, uint8_t color) {
+    writeBegin(pixelAddr(x, y));
+    while (w--)
+      Hal::transfer(color);
+    Hal::deselect();
+  }
+
+  static void writeLine(uint16_t x, uint16_t y, const uint8_t *pixels,
+			uint16_t w) {
+    writeBegin(pixelAddr(x, y));
+    while (w--)
+      Hal::transfer(*pixels++);
+    Hal::deselect();
+  }
+
+  // Fill W x H pixels from (X, Y) on, one burst per line.
+  static void fillRect(uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+		       uint8_t color) {
+    while (h--)
+      drawHLine(x, y++, w, color);
+  }
+
+  static void clearScreen(uint8_t color) {
+    fillRect(0, 0, Mode::x, Mode::y, color);
+  }
+
+  // Same as VS23S0x0::MoveBlock, but as that one may have started a
+  // reverse move, always waits for the block mover first.
+  static void moveBlock(uint16_t x_src, uint16_t y_src,
+			uint16_t x_dst, uint16_t y_dst,
+			uint8_t width, uint8_t height, uint8_t dir) {
+    uint8_t inc_src = (dir & 2) ? 0 : 1;
+    uint32_t dst = pixelAddr(x_dst, y_dst);
+    uint32_t src = pixelAddr(x_src, y_src);
+    uint8_t flags;
+
+    dir &= 1;
+    flags = ((dst & 1) << 1) | ((src & 1) << 2) | dir
+      | (Lowpass ? BLOCKMVC1_PYF : 0);
+
+    while (!Hal::blockFinished()) {}
+    Hal::select();
+    Hal::transfer(BLOCKMVC1);
+    Hal::transfer16(src >> 1);
+    Hal::transfer16(dst >> 1);
+    if (flags != VS23S0x0::m_block_flags) {
+      Hal::transfer(flags);
+      VS23S0x0::m_block_flags = flags;
+    }
+    Hal::deselect();
+    Hal::select();
+    Hal::transfer(BLOCKMVC2);
+    Hal::transfer16((pitch - width) * inc_src);
+    Hal::transfer(width);
+    Hal::transfer(height - 1);
+    Hal::deselect();
+    Hal::select();
+    Hal::transfer(BLOCKMV_S);
+    Hal::deselect();
+  }
+
+  // Same as VS23S0x0::blitRect.
+  static void blitRect(uint16_t x_src, uint16_t y_src,
+		       uint16_t x_dst, uint16_t y_dst,
+		       uint8_t width, uint8_t height) {
+    if ((y_dst > y_src && y_dst < y_src + height) ||
+	(y_src == y_dst && x_dst > x_src && x_dst < x_src + width))
+      moveBlock(x_src + width - 1, y_src + height - 1,
+		x_dst + width - 1, y_dst + height - 1,
+		width, height, 1);
+    else
+      moveBlock(x_src, y_src, x_dst, y_dst, width, height, 0);
+  }
+
+ private:
+  static bool matches(VS23S0x0 &vs) {
+    return vs.isPal() == Pal && vs.width() == Mode::x
+      && vs.height() == Mode::y && vs.piclinePitch() == pitch
+      && vs.piclineByteAddress(0) == first_line;
+  }
+
+  static inline void writeBegin(uint32_t address) {
+    Hal::select();
+    Hal::transfer32((uint32_t) WRITE_SRAM << 24 | address);
+  }
+};
+
+#endif
@@ -25,6 +25,8 @@
  * SOFTWARE.
  *****************************************************************************/
 
+#include <stdlib.h>
+#include <string.h>
 #include <SPI.h>
 #include "vs_hal.h"
 #include "vs23s0x0.h"
@@ -156,82 +158,177 @@ static inline void startBlockMove (void)
     VS23_DESELECT;
 }
 
-#if 1
-#define YYRGB(R, G, B) (( (  76 * R + 150 * G +  29 * B + 128) >> 8) + 0)
-#else
-#define YRGB(r,g,b) (( 0.299   * (r) + 0.587   * (g) + 0.114  *(b)))
-#endif
+#define PAL_SIZE (sizeof (pal) / sizeof (pal[0]))
+
+/// The palette in the space of YRGB, URGB and VRGB, sorted by Y for
+/// nearestIndex.  Allocated and built on first use, together with
+/// near_cache.
+struct near_entry {
+  int16_t y;
+  int16_t u;
+  int16_t v;
+  uint8_t index;		// Into pal[]
+};
+static struct near_entry *near_pal;
 
-#define ROW_BW 0
-#define ROW_B 4
-#define ROW_G 13
-#define ROW_R 14
+/// Colours matched recently, direct mapped by their RGB value.
+struct near_cache_entry {
+  uint32_t rgb;			// 0xffffffff if unused
+  uint8_t index;
+};
+static struct near_cache_entry *near_cache;
+
+/// Floyd-Steinberg error carried to the next line, three values per
+/// pixel, for writeLineRgb.  Allocated on first use.
+static int16_t *dither_err;
+static uint16_t dither_x;
+static uint16_t dither_y = 0xffff;
+
+static const uint8_t bayer4[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 },
+};
 
-#define ROW_RB 2
-#define ROW_RG 10
+static bool
+initNearest (void)
+{
+  uint16_t i, j;
 
-#define ROW_BR 4
-#define ROW_BG 5
+  near_cache = (struct near_cache_entry *)
+    malloc (NEAR_CACHE_SIZE * sizeof (*near_cache)
+	    + PAL_SIZE * sizeof (*near_pal));
+  if (!near_cache)
+    return false;
+  near_pal = (struct near_entry *) (near_cache + NEAR_CACHE_SIZE);
+  for (i = 0; i < PAL_SIZE; i++)
+    {
+      uint8_t r = pal[i].rgb >> 16;
+      uint8_t g = pal[i].rgb >> 8;
+      uint8_t b = pal[i].rgb;
+      struct near_entry e = { (int16_t) YRGB(r, g, b), (int16_t) URGB(r, g, b),
+			      (int16_t) VRGB(r, g, b), (uint8_t) i };
+
+      for (j = i; j > 0 && near_pal[j - 1].y > e.y; j--)
+	near_pal[j] = near_pal[j - 1];
+      near_pal[j] = e;
+    }
+  for (i = 0; i < NEAR_CACHE_SIZE; i++)
+    near_cache[i].rgb = 0xffffffff;
+  return true;
+}
 
-#define ROW_GB 1
-#define ROW_GR 8
+/* nearestIndex the slow way, for when there is no RAM for its tables:
+   the distance to every palette colour.  */
 
 static uint8_t
-colorFromRgb (uint8_t r, uint8_t g, uint8_t b)
+nearestIndexAll (int16_t y, int16_t u, int16_t v)
 {
-  uint32_t rgb = (r << 16) | (g << 8) | b;
-  uint8_t mid = 64;
-  uint8_t lo = 0;
-  uint8_t hi = 255;
-
-  //1. FIXME! add color correction.
-  //2. FIXME! add 8 locations cache algorithm.
+  uint32_t best = UINT32_MAX;
+  uint8_t index = 0;
+  uint16_t i;
 
-  while (hi >= lo)
+  for (i = 0; i < PAL_SIZE; i++)
     {
-      mid = lo + ((hi - lo) >> 1);
-
-      if (rgb == pal[mid].rgb)
+      uint8_t r = pal[i].rgb >> 16;
+      uint8_t g = pal[i].rgb >> 8;
+      uint8_t b = pal[i].rgb;
+      int32_t dy = YRGB(r, g, b) - y;
+      int32_t du = URGB(r, g, b) - u;
+      int32_t dv = VRGB(r, g, b) - v;
+      uint32_t d = NEAR_Y_WEIGHT * dy * dy + du * du + dv * dv;
+
+      if (d < best)
 	{
-	  return pal[mid].yuv;
+	  best = d;
+	  index = i;
 	}
-
-      if (rgb > pal[mid].rgb)
-	lo = mid + 1;
-      else
-	hi = mid - 1;
     }
+  return index;
+}
 
-  uint8_t hue = (YYRGB(r, g, b) >> 4) & 0x0f;;
-
-  if (r >= b && b > g)
-    return (ROW_RB * 16 + hue);
-
-  if (r >= g && g > b)
-    return (ROW_RG * 16 + hue);
-
-  if (b >= r && r > g)
-    return (ROW_BR * 16 + hue);
+/* Index into pal[] of the colour closest to R, G, B, by the distance
+   in YUV with Y weighted NEAR_Y_WEIGHT times.  The search starts at
+   the entries of the same Y and stops in either direction once the Y
+   difference alone is further away than the best match.  */
 
-  if (b >= g && g > r)
-    return (ROW_BG * 16 + hue);
+static uint8_t
+nearestIndex (uint8_t r, uint8_t g, uint8_t b)
+{
+  uint32_t rgb = ((uint32_t) r << 16) | (g << 8) | b;
+  struct near_cache_entry *c;
+  int16_t y, u, v;
+  uint32_t best = UINT32_MAX;
+  int up, down, lo, hi;
+  uint8_t index = 0;
+
+  y = YRGB(r, g, b);
+  u = URGB(r, g, b);
+  v = VRGB(r, g, b);
+  if (!near_pal && !initNearest ())
+    return nearestIndexAll (y, u, v);
+  c = &near_cache[(rgb * 2654435761UL) >> 24 & (NEAR_CACHE_SIZE - 1)];
+  if (c->rgb == rgb)
+    return c->index;
+
+  for (lo = 0, hi = PAL_SIZE; lo < hi; )
+    {
+      int mid = (lo + hi) / 2;
 
-  if (g >= b && b > r)
-    return (ROW_GB * 16 + hue);
+      if (near_pal[mid].y < y)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
 
-  if (g >= r && r > b)
-    return (ROW_GR * 16 + hue);
+  for (up = lo, down = lo - 1; up < (int) PAL_SIZE || down >= 0; )
+    {
+      int k;
 
-  if (r > b && r > g)
-    return (ROW_R * 16 + hue);
+      for (k = 0; k < 2; k++)
+	{
+	  int *i = k ? &down : &up;
+	  const struct near_entry *e;
+	  int32_t dy, du, dv;
+	  uint32_t d;
+
+	  if (*i < 0 || *i >= (int) PAL_SIZE)
+	    continue;
+	  e = &near_pal[*i];
+	  dy = e->y - y;
+	  if ((uint32_t) (NEAR_Y_WEIGHT * dy * dy) >= best)
+	    {
+	      *i = k ? -1 : PAL_SIZE;
+	      continue;
+	    }
+	  du = e->u - u;
+	  dv = e->v - v;
+	  d = NEAR_Y_WEIGHT * dy * dy + du * du + dv * dv;
+	  if (d < best)
+	    {
+	      best = d;
+	      index = e->index;
+	    }
+	  *i += k ? -1 : 1;
+	}
+    }
 
-  if (b > r && b > g)
-    return (ROW_B * 16 + hue);
+  c->rgb = rgb;
+  c->index = index;
+  return index;
+}
 
-  if (g > r && g > b)
-    return (ROW_G * 16 + hue);
+static inline uint8_t
+colorFromRgb (uint8_t r, uint8_t g, uint8_t b)
+{
+  return pal[nearestIndex (r, g, b)].yuv;
+}
 
-  return (ROW_BW * 16 + hue);
+static inline uint8_t
+clamp8 (int16_t c)
+{
+  return c < 0 ? 0 : (c > 255 ? 255 : c);
 }
 
 // ---------------------------------------------------------------------------
@@ -242,7 +339,10 @@ uint16_t
 VS23S0x0::SpiRamReadRegister (uint16_t opcode)
 {
   uint16_t result;
+  uint8_t ics = m_ic_mask;
 
+  // Only one IC may answer.
+  selectIcs (ics & -ics);
 #ifdef SPI_BYTE
   vs23Select();
   SPI.transfer(opcode);
@@ -255,6 +355,7 @@ VS23S0x0::SpiRamReadRegister (uint16_t opcode)
   result = SPI.transfer16 (0);
   vs23Deselect();
 #endif
+  selectIcs (ics);
   return result;
 }
 
@@ -314,6 +415,20 @@ SpiRamWriteByteRegister (uint16_t opcode, uint16_t data)
 
 }
 
+// ---------------------------------------------------------------------------
+// Send the following commands to the VS23 ICs in MASK only.  The
+// multi-IC register enables the ICs whose bits are clear, all of them
+// listen to the register itself.
+//
+void
+VS23S0x0::selectIcs (uint8_t mask)
+{
+  if (mask == m_ic_mask || mask == 0)
+    return;
+  SpiRamWriteByteRegister(WRITE_MULTIIC, ~mask & 0xf);
+  m_ic_mask = mask;
+}
+
 // ---------------------------------------------------------------------------
 // Equivalent to SPIWriteRegister32
 // Write 32b register
@@ -344,7 +459,6 @@ SpiRamWriteProgram (uint16_t opcode, uint16_t data1, uint16_t data2)
 static void
 SpiRamWriteByte (uint32_t address, uint8_t data)
 {
-  // address = address + (channel * ch_block);
 #ifdef SPI_BYTE
   uint8_t req[5];
 
@@ -372,7 +486,6 @@ SpiRamWriteByte (uint32_t address, uint8_t data)
 static void
 SpiRamWriteWord (uint16_t waddress, uint16_t data)
 {
-  // address = address + (channel * ch_block);
   uint32_t address = (uint32_t) waddress << 1;
 
 #ifdef SPI_BYTE
@@ -397,11 +510,13 @@ SpiRamWriteWord (uint16_t waddress, uint16_t data)
 #endif
 }
 
+uint8_t VS23S0x0::m_block_flags = 0xE0;
+
 static void
 SpiRamWriteBMCtrl (uint16_t opcode, uint16_t data1,
 		   uint16_t data2, uint16_t data3)
 {
-  static uint8_t LSB = 0xE0;
+  uint8_t &LSB = VS23S0x0::m_block_flags;
   uint8_t req[6] = { (uint8_t)opcode, (uint8_t)(data1 >> 8),
     (uint8_t)data1, (uint8_t)(data2 >> 8),
     (uint8_t)data2, (uint8_t)data3 };
@@ -428,6 +543,49 @@ SpiRamWriteBM2Ctrl (uint16_t data1, uint16_t data2,
   vs23Deselect();
 }
 
+/* Clear the whole SRAM: one burst seeds the first CLEAR_SEED bytes,
+   then the block mover copies everything cleared so far behind it,
+   doubling the cleared area with every move (at most 255 x 255 bytes
+   each) instead of writing all 128KB over SPI.  */
+
+#define CLEAR_SEED 256
+
+static void
+clearSram (void)
+{
+  uint32_t filled = CLEAR_SEED;
+
+  vs23Select();
+  SPI.transfer32 (WRITE_SRAM << 24);
+  for (int i = 0; i < CLEAR_SEED; i++)
+    SPI.transfer (0);
+  vs23Deselect();
+
+  while (filled < SRAM_SIZE)
+    {
+      uint32_t n = SRAM_SIZE - filled;
+      uint32_t width = 255;
+      uint32_t rows;
+
+      if (n > filled)
+	n = filled;
+      rows = n / width;
+      if (rows > 255)
+	rows = 255;
+      if (rows == 0)
+	{
+	  width = n;
+	  rows = 1;
+	}
+      while (!blockFinished()) {}
+      SpiRamWriteBMCtrl (BLOCKMVC1, 0, filled >> 1, (filled & 1) << 1);
+      SpiRamWriteBM2Ctrl (0, width, rows - 1);
+      startBlockMove();
+      filled += width * rows;
+    }
+  while (!blockFinished()) {}
+}
+
 // ---------------------------------------------------------------------------
 // Equivalent to _protoline
 // Set proto type picture line indexes
@@ -479,21 +637,362 @@ void
 VS23S0x0::setPixelRgb (uint16_t xpos, uint16_t ypos, uint8_t r, uint8_t g,
 		       uint8_t b)
 {
-  uint8_t pixdata = colorFromRgb(r, g, b);
+  setPixelYuv(xpos, ypos, colorFromRgb(r, g, b));
+}
 
-  uint32_t byteaddress;
+/* The palette colour closest to R, G, B, see nearestIndex.  */
 
-  byteaddress = pixelAddr(xpos, ypos);
-  SpiRamWriteByte(byteaddress, pixdata);
+uint8_t
+VS23S0x0::nearestColor (uint8_t r, uint8_t g, uint8_t b)
+{
+  return colorFromRgb (r, g, b);
+}
+
+/* Write the LEN pixels at RGB, three bytes each with red first, from
+   (X, Y) to the right in one burst, matched against the palette.
+   DITHER_ORDERED adds a 4x4 Bayer pattern of one Y step.
+   DITHER_DIFFUSION spreads the error Floyd-Steinberg fashion, into the
+   next line as well if that is the next one written, with the same X;
+   pixels past the first DITHER_MAX_WIDTH are written undithered, and
+   all of them if there is no RAM for the error buffer.  */
+
+void
+VS23S0x0::writeLineRgb (uint16_t x, uint16_t y, const uint8_t *rgb,
+			uint16_t len, uint8_t dither)
+{
+  int16_t right[3] = { 0, 0, 0 };
+  int16_t below[3] = { 0, 0, 0 };
+  uint8_t *out = NULL;
+  uint16_t i;
+  uint8_t c;
+
+  if (dither == DITHER_DIFFUSION && !dither_err)
+    {
+      dither_err = (int16_t *) calloc (3 * DITHER_MAX_WIDTH,
+				       sizeof (*dither_err));
+      if (!dither_err)
+	dither = DITHER_NONE;
+    }
+  if (dither == DITHER_DIFFUSION)
+    {
+      if (y != (uint16_t) (dither_y + 1) || x != dither_x)
+	memset (dither_err, 0, 3 * DITHER_MAX_WIDTH * sizeof (*dither_err));
+      dither_x = x;
+      dither_y = y;
+    }
+
+  if (m_shadow)
+    {
+      out = shadowSpan (x, y, len);
+      if (!out)
+	return;
+    }
+  else
+    {
+      vs23Select();
+      SPI.transfer32 (WRITE_SRAM << 24 | (pixelAddr (x, y) & 0x00ffffff));
+    }
+  for (i = 0; i < len; i++, rgb += 3)
+    {
+      int16_t want[3];
+      uint8_t index;
+
+      // The error buffer ends here.
+      if (dither == DITHER_DIFFUSION && i == DITHER_MAX_WIDTH)
+	dither = DITHER_NONE;
+      for (c = 0; c < 3; c++)
+	want[c] = rgb[c];
+      if (dither == DITHER_ORDERED)
+	for (c = 0; c < 3; c++)
+	  want[c] += bayer4[y & 3][(x + i) & 3] - 8;
+      else if (dither == DITHER_DIFFUSION)
+	for (c = 0; c < 3; c++)
+	  want[c] += dither_err[3 * i + c] + right[c];
+
+      index = nearestIndex (clamp8 (want[0]), clamp8 (want[1]),
+			    clamp8 (want[2]));
+      if (out)
+	*out++ = pal[index].yuv;
+      else
+	SPI.transfer (pal[index].yuv);
+
+      if (dither != DITHER_DIFFUSION)
+	continue;
+      // Error weights 7/16 right, 3/16, 5/16 and 1/16 below.  The
+      // entry of this pixel turns into the one for the next line.
+      for (c = 0; c < 3; c++)
+	{
+	  int16_t err = want[c]
+	    - (uint8_t) (pal[index].rgb >> (16 - 8 * c));
+
+	  if (i > 0)
+	    dither_err[3 * (i - 1) + c] += err * 3 / 16;
+	  dither_err[3 * i + c] = err * 5 / 16 + below[c];
+	  below[c] = err / 16;
+	  right[c] = err * 7 / 16;
+	}
+    }
+  if (!out)
+    vs23Deselect();
 }
 
 void
 VS23S0x0::setPixelYuv (uint16_t xpos, uint16_t ypos, uint8_t color)
 {
+  if (m_shadow)
+    {
+      if (xpos < XPIXELS && ypos < YPIXELS)
+	{
+	  m_shadow[(uint32_t) ypos * XPIXELS + xpos] = color;
+	  m_shadow_dirty[ypos] |= 1UL << (xpos >> m_shadow_shift);
+	}
+      return;
+    }
+
   uint32_t byteaddress = pixelAddr (xpos, ypos);
   SpiRamWriteByte(byteaddress, color);
 }
 
+/* Draw LEN pixels of COLOR from (X, Y) to the right, in one
+   burst.  */
+
+void
+VS23S0x0::drawHSpan (uint16_t x, uint16_t y, uint16_t len, uint8_t color)
+{
+  if (m_shadow)
+    {
+      uint8_t *p = shadowSpan (x, y, len);
+
+      if (p)
+	memset (p, color, len);
+      return;
+    }
+
+  vs23Select();
+  SPI.transfer32 (WRITE_SRAM << 24 | (pixelAddr (x, y) & 0x00ffffff));
+  while (len--)
+    SPI.transfer (color);
+  vs23Deselect();
+}
+
+/* Write the LEN pixels at PIXELS from (X, Y) to the right, in one
+   burst.  */
+
+void
+VS23S0x0::writeSpan (uint16_t x, uint16_t y, const uint8_t *pixels,
+		     uint16_t len)
+{
+  if (m_shadow)
+    {
+      uint8_t *p = shadowSpan (x, y, len);
+
+      if (p)
+	memcpy (p, pixels, len);
+      return;
+    }
+
+  vs23Select();
+  SPI.transfer32 (WRITE_SRAM << 24 | (pixelAddr (x, y) & 0x00ffffff));
+  while (len--)
+    SPI.transfer (*pixels++);
+  vs23Deselect();
+}
+
+/* Draw LEN pixels of COLOR from (X, Y) down.  Long spans write the
+   top pixel and have the block mover copy it down line by line, 255
+   lines per move.  */
+
+void
+VS23S0x0::drawVSpan (uint16_t x, uint16_t y, uint16_t len, uint8_t color)
+{
+  if (len < VSPAN_MOVE_MIN || m_shadow)
+    {
+      while (len--)
+	setPixelYuv (x, y++, color);
+      return;
+    }
+
+  setPixelYuv (x, y, color);
+  for (len--; len; )
+    {
+      uint8_t n = len > 255 ? 255 : len;
+
+      MoveBlock (x, y, x, y + 1, 1, n, 0);
+      y += n;
+      len -= n;
+    }
+}
+
+// Chunks FIRST to LAST of a shadow line as dirty bits.
+static inline uint32_t
+chunkMask (uint8_t first, uint8_t last)
+{
+  return (0xffffffffUL >> (31 - last)) & (0xffffffffUL << first);
+}
+
+/* The LEN pixels from (X, Y) on in the shadow frame buffer, marked
+   dirty.  LEN is clipped to the line, NULL if nothing is left.  */
+
+uint8_t *
+VS23S0x0::shadowSpan (uint16_t x, uint16_t y, uint16_t &len)
+{
+  if (x >= XPIXELS || y >= YPIXELS || len == 0)
+    return NULL;
+  if (len > XPIXELS - x)
+    len = XPIXELS - x;
+  m_shadow_dirty[y] |= chunkMask (x >> m_shadow_shift,
+				  (x + len - 1) >> m_shadow_shift);
+  return m_shadow + (uint32_t) y * XPIXELS + x;
+}
+
+/* Draw into a shadow frame buffer in MCU RAM from now on, PIXELS if
+   given, which must hold width() x height() bytes, or one allocated
+   here.  It starts out as a copy of the frame buffer.  Drawing only
+   stores to RAM and marks the pixels dirty, line by line in
+   SHADOW_CHUNKS chunks, until present writes them to the SRAM.  The
+   block mover is emulated, clearScreen also clears the SRAM at once.
+   False if there is not enough RAM.  setMode drops the shadow.  */
+
+bool
+VS23S0x0::beginShadow (uint8_t *pixels)
+{
+  uint8_t *p;
+  uint16_t x, y;
+
+  freeShadow ();
+  m_shadow_owned = pixels == NULL;
+  if (m_shadow_owned)
+    pixels = (uint8_t *) malloc ((uint32_t) XPIXELS * YPIXELS);
+  m_shadow_dirty = (uint32_t *) calloc (YPIXELS, sizeof (uint32_t));
+  if (!pixels || !m_shadow_dirty)
+    {
+      if (m_shadow_owned)
+	free (pixels);
+      free (m_shadow_dirty);
+      m_shadow_dirty = NULL;
+      return false;
+    }
+  m_shadow = pixels;
+  for (m_shadow_shift = 0;
+       (XPIXELS - 1) >> m_shadow_shift >= SHADOW_CHUNKS; m_shadow_shift++)
+    ;
+
+  // The channels show the same picture, read the first one.
+  selectIcs (m_channels & -m_channels);
+  for (p = m_shadow, y = 0; y < YPIXELS; y++)
+    {
+      vs23Select();
+      SPI.transfer32 (READ_SRAM << 24 | (pixelAddr (0, y) & 0x00ffffff));
+      for (x = 0; x < XPIXELS; x++)
+	*p++ = SPI.transfer (0);
+      vs23Deselect();
+    }
+  selectIcs (m_channels);
+  return true;
+}
+
+void
+VS23S0x0::freeShadow ()
+{
+  if (m_shadow && m_shadow_owned)
+    free (m_shadow);
+  free (m_shadow_dirty);
+  m_shadow = NULL;
+  m_shadow_dirty = NULL;
+}
+
+/* Present what is left and draw to the SRAM directly again.  */
+
+void
+VS23S0x0::endShadow ()
+{
+  present ();
+  freeShadow ();
+}
+
+/* Write the dirty pixels of the shadow frame buffer to the SRAM, a
+   burst per run of dirty chunks.  With VSYNC the writes start when
+   the beam next leaves the picture.  */
+
+void
+VS23S0x0::present (bool vsync)
+{
+  uint16_t y;
+
+  if (!m_shadow)
+    return;
+
+  if (vsync)
+    {
+      while (currentLine() >= ENDLINE) {}
+      while (currentLine() < ENDLINE) {}
+    }
+
+  for (y = 0; y < YPIXELS; y++)
+    {
+      uint32_t dirty = m_shadow_dirty[y];
+      const uint8_t *line = m_shadow + (uint32_t) y * XPIXELS;
+      uint16_t x = 0;
+
+      m_shadow_dirty[y] = 0;
+      while (dirty)
+	{
+	  uint16_t end = x;
+
+	  for (; dirty & 1; dirty >>= 1)
+	    end += 1 << m_shadow_shift;
+	  if (end > XPIXELS)
+	    end = XPIXELS;
+	  if (end > x)
+	    {
+	      vs23Select();
+	      SPI.transfer32 (WRITE_SRAM << 24
+			      | (pixelAddr (x, y) & 0x00ffffff));
+	      for (; x < end; x++)
+		SPI.transfer (line[x]);
+	      vs23Deselect();
+	    }
+	  // Skip the clean chunk that ended the run.
+	  dirty >>= 1;
+	  x += 1 << m_shadow_shift;
+	}
+    }
+}
+
+/* MoveBlock on the shadow frame buffer, byte by byte in the order the
+   block mover goes.  The shadow has no bextra, so a move without
+   skips that runs over a line end continues on the next line.  */
+
+void
+VS23S0x0::shadowMove (uint16_t x_src, uint16_t y_src,
+		      uint16_t x_dst, uint16_t y_dst,
+		      uint8_t width, uint8_t height, uint8_t dir)
+{
+  int32_t src = (int32_t) y_src * XPIXELS + x_src;
+  int32_t dst = (int32_t) y_dst * XPIXELS + x_dst;
+  int32_t size = (int32_t) XPIXELS * YPIXELS;
+  int8_t step = (dir & 1) ? -1 : 1;
+  int16_t skip = (dir & 2) ? 0 : XPIXELS - width;
+  uint8_t i, j;
+
+  for (i = 0; i < height; i++)
+    {
+      for (j = 0; j < width; j++)
+	{
+	  if (src >= 0 && src < size && dst >= 0 && dst < size)
+	    {
+	      m_shadow[dst] = m_shadow[src];
+	      m_shadow_dirty[dst / XPIXELS]
+		|= 1UL << ((dst % XPIXELS) >> m_shadow_shift);
+	    }
+	  src += step;
+	  dst += step;
+	}
+      src += step * skip;
+      dst += step * skip;
+    }
+}
+
 void
 VS23S0x0::setBorder (uint8_t y, uint8_t uv, uint16_t dx, uint16_t width)
 {
@@ -511,10 +1010,12 @@ VS23S0x0::setBorder(uint8_t y, uint8_t uv)
 
 // ---------------------------------------------------------------------------
 // Equivalent to Config
-// Initialize the VS32S0x0 chip
+// Initialize the VS32S0x0 chips in the mask CHANNELS, bit n for the
+// nth VS23 on the bus, 0 for the ones given to begin; they get the
+// same commands, and keep getting them until the next videoInit.
 //
 void
-VS23S0x0::videoInit (uint8_t channel)
+VS23S0x0::videoInit (uint8_t channels)
 {
   uint16_t i, j;
   uint32_t w;
@@ -539,12 +1040,16 @@ VS23S0x0::videoInit (uint8_t channel)
   //Serial.printf("Last line %d\n", PICLINE_MAX);
 #endif
 
+  // 1. Select the VS23s for following commands in case there are
+  // several VS23 ICs connected to same SPI bus.
+  if (channels)
+    m_channels = channels & 0xf;
+  m_ic_mask = 0;
+  selectIcs (m_channels);
+
   // Disable video generation
   SpiRamWriteRegister(VDCTRL2, 0);
 
-  // 1. Select the first VS23 for following commands in case there
-  // are several VS23 ICs connected to same SPI bus.
-  SpiRamWriteByteRegister(WRITE_MULTIIC, 0xe);
   // 2. Set SPI memory address autoincrement
   SpiRamWriteByteRegister(WRITE_STATUS, 0x40);
 
@@ -556,8 +1061,7 @@ VS23S0x0::videoInit (uint8_t channel)
   SpiRamWriteRegister(VDCTRL1,
 		      (VDCTRL1_PLL_ENABLE) | (VDCTRL1_SELECT_PLL_CLOCK));
   // 6. Clear the video memory
-  for (w = 0; w < 65536; w++)
-    SpiRamWriteWord((uint16_t)w, 0x0000);	// Clear memory
+  clearSram();
   // 7. Set length of one complete line (unit: PLL clocks)
   SpiRamWriteRegister(LINELEN, (PLLCLKS_PER_LINE));
   // 9. Define where Line Indexes are stored in memory
@@ -972,8 +1476,13 @@ VS23S0x0::videoInit (uint8_t channel)
 		       | (VDCTRL2_ENABLE_VIDEO));
 }
 
+/* Set up the VS23 ICs in the mask CHANNELS, bit n for the nth IC on
+   the bus.  They show the same picture: drawing goes to all of them
+   at once, reads come from the first one.  */
+
 void
-VS23S0x0::begin (bool interlace, bool lowpass, uint8_t system)
+VS23S0x0::begin (bool interlace, bool lowpass, uint8_t system,
+		 uint8_t channels)
 {
   m_vsync_enabled = false;
   m_interlace = interlace;
@@ -981,10 +1490,16 @@ VS23S0x0::begin (bool interlace, bool lowpass, uint8_t system)
 
   m_pal = system != 0;
 
+  m_channels = channels & 0xf ? channels & 0xf : 1;
+  m_ic_mask = 0;
+  selectIcs (m_channels);
+
   m_gpio_state = 0xf;
   SpiRamWriteRegister (WRITE_GPIO_CTRL, m_gpio_state);
 
   m_line_adjust = 0;
+  m_shadow = NULL;
+  m_shadow_dirty = NULL;
 
   setMode(4);
 }
@@ -1025,6 +1540,8 @@ init_timer0 (void)
 void VS23S0x0::calibrateVsync()
 {
   uint32_t now, now2, cycles;
+  // Keep to the first IC instead of switching around every read.
+  selectIcs (m_channels & -m_channels);
   while (currentLine() != 100) {};
   now = init_timer0 ();
   while (currentLine() == 100) {};
@@ -1040,27 +1557,39 @@ void VS23S0x0::calibrateVsync()
     while (currentLine() != 100) {};
   }
   m_cycles_per_frame = cycles;
+  selectIcs (m_channels);
 }
 
 bool
 VS23S0x0::setMode (uint8_t mode)
+{
+  return setMode (m_pal ? &modes_pal[mode] : &modes_ntsc[mode]);
+}
+
+/* Switch to MODE, which has to stay valid while it is used; see
+   VS23Mode in vs23s0x0-fixed.h.  */
+
+bool
+VS23S0x0::setMode (const struct video_mode_t *mode)
 {
   setSyncLine(0);
+  freeShadow();
 
-  m_current_mode = m_pal ? &modes_pal[mode] : &modes_ntsc[mode];
+  m_current_mode = mode;
   m_first_line_addr = PICLINE_BYTE_ADDRESS(0);
   m_pitch = PICLINE_BYTE_ADDRESS(1) - m_first_line_addr;
 
   videoInit(0);
-  calibrateVsync();
+  // Measured on first use, see cyclesPerFrame().
+  m_cycles_per_frame = 0;
 
 #if 0
-  if (m_pal && F_CPU / m_cycles_per_frame < 45) {
+  if (m_pal && F_CPU / cyclesPerFrame() < 45) {
     // We are in PAL mode, but the hardware has an NTSC crystal.
     //m_pal = false;
     //goto retry;
     Serial.println ("NTSC board, PAL mode");
-  } else if (!m_pal && F_CPU / m_cycles_per_frame > 70) {
+  } else if (!m_pal && F_CPU / cyclesPerFrame() > 70) {
     // We are in NTSC mode, but the hardware has a PAL crystal.
     //m_pal = true;
     //goto retry;
@@ -1076,8 +1605,9 @@ VS23S0x0::setMode (uint8_t mode)
 
   // Sony KX-14CP1 and possibly other displays freak out if we start drawing
   // stuff before they had a chance to synchronize with the new mode, so we
-  // wait a few frames.
-  delay(160);
+  // give them a few frames.  The sketch can set up its own state
+  // meanwhile, see ready().
+  m_ready_at = millis() + 160;
 
   return true;
 }
@@ -1096,6 +1626,12 @@ MoveBlock (uint16_t x_src, uint16_t y_src,
   // stay in the first line of the source rectangle
   // if bit 1 of dir is set
   uint8_t inc_src = (dir & 2) ? 0 : 1;
+
+  if (m_shadow)
+    {
+      shadowMove (x_src, y_src, x_dst, y_dst, width, height, dir);
+      return;
+    }
   dir &= 1;
 
 #ifdef DEBUG
@@ -1148,14 +1684,19 @@ VS23S0x0::fillRectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
   const int height = y2 - y1;
   const int width_segs = width / seg_width;
 
+  if (m_shadow)
+    {
+      for (; y1 < y2; y1++)
+	drawHSpan (x1, y1, width, color);
+      return;
+    }
+
   // fill top pixels with background
   while (!blockFinished()) {}
   // line at most two chars then duplicate with blitter
   int preset = seg_width + ((width_segs == 1) ? 0 : seg_width);
 
-  //   gfx.drawLine(x1, y1, x1 + preset - 1, y1, color);
-  for (int i = x1; i <= (x1 + preset - 1); i++)
-    setPixelYuv (i, y1, color);
+  drawHSpan (x1, y1, preset, color);
 
   // Apparently source and destination address have to be
   // at least 4 bytes apart. Alignment is not an issue.
@@ -1185,6 +1726,17 @@ VS23S0x0::fillRectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
 void
 VS23S0x0::clearScreen (uint8_t color)
 {
+  if (m_shadow)
+    {
+      uint8_t *shadow = m_shadow;
+
+      memset (m_shadow, color, (uint32_t) XPIXELS * YPIXELS);
+      memset (m_shadow_dirty, 0, YPIXELS * sizeof (uint32_t));
+      m_shadow = NULL;
+      fillRectangle (0, 0, width(), height(), color);
+      m_shadow = shadow;
+      return;
+    }
 
 #if 0
   uint32_t address;
@@ -161,7 +161,28 @@
 #define PICLINE_WORD_ADDRESS(n) (PICLINE_START/2+(PICLINE_LENGTH_BYTES/2+BEXTRA/2)*(n))
 #define PICLINE_BYTE_ADDRESS(n) ((uint32_t)(PICLINE_START+((uint32_t)(PICLINE_LENGTH_BYTES)+BEXTRA)*(n)))
 
-#define PICLINE_MAX ((131072-PICLINE_START)/(PICLINE_LENGTH_BYTES+BEXTRA))
+/// Size of the video SRAM in bytes.
+#define SRAM_SIZE 131072
+#define PICLINE_MAX ((SRAM_SIZE-PICLINE_START)/(PICLINE_LENGTH_BYTES+BEXTRA))
+
+/// Shortest drawVSpan that is drawn with the block mover, shorter ones
+/// are cheaper as single pixel writes
+#define VSPAN_MOVE_MIN 4
+
+/// Colours nearestColor remembers, a power of two
+#define NEAR_CACHE_SIZE 256
+/// Weight of the Y difference against those of U and V in nearestColor
+#define NEAR_Y_WEIGHT 2
+/// Longest line writeLineRgb diffuses errors over
+#define DITHER_MAX_WIDTH 512
+
+/// Dithering of writeLineRgb
+#define DITHER_NONE 0
+#define DITHER_ORDERED 1
+#define DITHER_DIFFUSION 2
+
+/// Chunks a shadow frame buffer line is tracked in, see beginShadow
+#define SHADOW_CHUNKS 32
 
 /// 8-bit RGB to 8-bit YUV444 conversion
 #define YRGB(r,g,b) ((76*r+150*g+29*b)>>8)
@@ -189,6 +210,7 @@
 #define WRITE_MULTIIC 0xb8
 #define WRITE_GPIO_CTRL 0x82
 #define WRITE_SRAM 0x02
+#define READ_SRAM 0x03
 
 /// Bit definitions
 #define VDCTRL1 0x2B
@@ -254,7 +276,8 @@ struct video_mode_t {
 class VS23S0x0
 {
  public:
-  void begin(bool interlace = false, bool lowpass = false, uint8_t system = 1);
+  void begin(bool interlace = false, bool lowpass = false, uint8_t system = 1,
+	     uint8_t channels = 1);
   void SpiRamWriteRegister (uint16_t opcode, uint16_t data);
   uint16_t SpiRamReadRegister (uint16_t opcode);
   void clearScreen (uint8_t colour);
@@ -290,13 +313,29 @@ class VS23S0x0
   void setPixelRgb(uint16_t xpos, uint16_t ypos,
 		   uint8_t r, uint8_t g, uint8_t b);
 
+  uint8_t nearestColor(uint8_t r, uint8_t g, uint8_t b);
+  void writeLineRgb(uint16_t x, uint16_t y, const uint8_t *rgb, uint16_t len,
+		    uint8_t dither = DITHER_NONE);
+
+  void drawHSpan(uint16_t x, uint16_t y, uint16_t len, uint8_t color);
+  void writeSpan(uint16_t x, uint16_t y, const uint8_t *pixels, uint16_t len);
+  void drawVSpan(uint16_t x, uint16_t y, uint16_t len, uint8_t color);
+
+  bool beginShadow(uint8_t *pixels = NULL);
+  void endShadow();
+  void present(bool vsync = false);
+  inline bool shadowed() {
+    return m_shadow != NULL;
+  }
+
   void setColorSpace(uint8_t palette);
 
   bool setMode(uint8_t mode);
+  bool setMode(const struct video_mode_t *mode);
   void calibrateVsync();
   void setSyncLine(uint16_t line);
 
-  void videoInit (uint8_t channel = 0);
+  void videoInit (uint8_t channels = 0);
   void SetLineIndex(uint16_t line, uint16_t wordAddress);
   void SetPicIndex(uint16_t line, uint32_t byteAddress, uint16_t protoAddress);
   void setBorder(uint8_t y, uint8_t uv);
@@ -308,6 +347,10 @@ class VS23S0x0
   void fillRectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint8_t);
   void reset();
 
+  /// BLOCKMVC1 flags byte the chip holds, 0xE0 if not known.  A move
+  /// with the same flags leaves it out; VS23S0x0Fixed shares it.
+  static uint8_t m_block_flags;
+
   inline void setInterlace(bool interlace) {
     m_interlace = interlace;
   }
@@ -346,23 +389,54 @@ class VS23S0x0
   }
 
   uint32_t cyclesPerFrame() {
+    if (!m_cycles_per_frame)
+      calibrateVsync();
     return m_cycles_per_frame;
   }
 
+  // True once the display had time to lock onto the current mode.
+  inline bool ready() {
+    return (long)(millis() - m_ready_at) >= 0;
+  }
+
+  void waitReady() {
+    while (!ready()) {}
+  }
+
  private:
   void setBorder (uint8_t y, uint8_t uv, uint16_t dx, uint16_t width);
+  void freeShadow();
+  void selectIcs(uint8_t mask);
+  uint8_t *shadowSpan(uint16_t x, uint16_t y, uint16_t &len);
+  void shadowMove(uint16_t x_src, uint16_t y_src, uint16_t x_dst,
+		  uint16_t y_dst, uint8_t width, uint8_t height, uint8_t dir);
 
   bool m_vsync_enabled;
   uint32_t m_cycles_per_frame;
+  unsigned long m_ready_at;	// millis() when the display is synced
   const struct video_mode_t *m_current_mode;
 
   uint8_t m_gpio_state;
 
+  /// VS23 ICs on the bus that get the commands, bit n for the nth IC;
+  /// videoInit sets them up alike and reads ask only the first one.
+  uint8_t m_channels;
+  /// ICs the multi-IC register enables right now, 0 if not known
+  uint8_t m_ic_mask;
+
   uint32_t m_pitch;  // Distance between piclines in bytes
   uint32_t m_first_line_addr;
   uint16_t m_sync_line;
   uint32_t m_line_adjust;
 
+  /// Shadow frame buffer in MCU RAM, width() x height(), or NULL.
+  /// Bit n of m_shadow_dirty[y] marks pixels n << m_shadow_shift on of
+  /// line y as not written to the SRAM yet.
+  uint8_t *m_shadow;
+  bool m_shadow_owned;
+  uint32_t *m_shadow_dirty;
+  uint8_t m_shadow_shift;
+
   bool m_interlace;
   bool m_pal;
   bool m_lowpass;
@@ -0,0 +1,261 @@
+#include <math.h>
+#include "Arduino.h"
+#include "vs23s0x0.h"
+#include "gauge.h"
+
+/* Per-pixel versions of the driver geometry, as they would be written
+   on top of setPixelYuv, to compare against.  They set the same
+   pixels as drawLine, drawCircle, drawArc, fillCircle, fillPolygon
+   and fillRectangle, clipped to the frame buffer.  */
+
+/* Start and end of the naiveArc arc, scaled by 1024 as in drawArc.  */
+static int16_t arcSx, arcSy, arcEx, arcEy;
+static bool arcWide;
+
+static void
+plot (int16_t x, int16_t y, uint8_t color)
+{
+  if (x >= 0 && y >= 0 && x < (int16_t) width () && y < (int16_t) height ())
+    setPixelYuv (x, y, color);
+}
+
+void
+naiveLine (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color)
+{
+  int32_t dx = x1 > x0 ? x1 - x0 : x0 - x1;
+  int32_t dy = y1 > y0 ? y0 - y1 : y1 - y0;
+  int8_t sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+  int32_t err = dx + dy;
+
+  for (;;)
+    {
+      int32_t e2 = 2 * err;
+
+      plot (x0, y0, color);
+      if (x0 == x1 && y0 == y1)
+	break;
+      if (e2 >= dy)
+	{
+	  err += dy;
+	  x0 += sx;
+	}
+      if (e2 <= dx)
+	{
+	  err += dx;
+	  y0 += sy;
+	}
+    }
+}
+
+static bool
+arcHas (int16_t x, int16_t y)
+{
+  int32_t from = (int32_t) arcSx * y - (int32_t) arcSy * x;
+  int32_t to = (int32_t) x * arcEy - (int32_t) y * arcEx;
+
+  return arcWide ? from >= 0 || to >= 0 : from >= 0 && to >= 0;
+}
+
+/* The eight points of each midpoint step, only those on the arc if
+   ARC.  */
+
+static void
+circlePoints (int16_t cx, int16_t cy, uint16_t r, uint8_t color, bool arc)
+{
+  int16_t x = 0, y = r;
+  int32_t d = 1 - (int32_t) r;
+  uint8_t i;
+
+  while (x <= y)
+    {
+      for (i = 0; i < 8; i++)
+	{
+	  int16_t px = (i & 1) ? y : x;
+	  int16_t py = (i & 1) ? x : y;
+
+	  if (i & 2)
+	    px = -px;
+	  if (i & 4)
+	    py = -py;
+	  if (!arc || arcHas (px, py))
+	    plot (cx + px, cy + py, color);
+	}
+      if (d < 0)
+	d += 2 * x + 3;
+      else
+	{
+	  d += 2 * (x - y) + 5;
+	  y--;
+	}
+      x++;
+    }
+}
+
+void
+naiveCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color)
+{
+  circlePoints (cx, cy, r, color, false);
+}
+
+void
+naiveArc (int16_t cx, int16_t cy, uint16_t r, int16_t start, int16_t end,
+	  uint8_t color)
+{
+  int16_t sweep = end - start;
+
+  if (sweep >= 360 || sweep <= -360)
+    {
+      naiveCircle (cx, cy, r, color);
+      return;
+    }
+  sweep = (sweep + 360) % 360;
+  if (sweep == 0)
+    return;
+  arcSx = cos (start * M_PI / 180) * 1024;
+  arcSy = sin (start * M_PI / 180) * 1024;
+  arcEx = cos (end * M_PI / 180) * 1024;
+  arcEy = sin (end * M_PI / 180) * 1024;
+  arcWide = sweep > 180;
+  circlePoints (cx, cy, r, color, true);
+}
+
+/* Each midpoint step fills the lines between its points.  */
+
+void
+naiveFillCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color)
+{
+  int16_t x = 0, y = r;
+  int32_t d = 1 - (int32_t) r;
+  int16_t i;
+
+  while (x <= y)
+    {
+      for (i = -y; i <= y; i++)
+	{
+	  plot (cx + i, cy + x, color);
+	  plot (cx + i, cy - x, color);
+	}
+      for (i = -x; i <= x; i++)
+	{
+	  plot (cx + i, cy + y, color);
+	  plot (cx + i, cy - y, color);
+	}
+      if (d < 0)
+	d += 2 * x + 3;
+      else
+	{
+	  d += 2 * (x - y) + 5;
+	  y--;
+	}
+      x++;
+    }
+}
+
+/* A pixel is inside if an odd number of edges cross its line left of
+   it, by the crossing fillPolygon works out.  */
+
+void
+naiveFillPolygon (const int16_t *points, uint8_t n, uint8_t color)
+{
+  int16_t left, right, top, bottom, x, y;
+  uint8_t i;
+
+  if (n < 3)
+    return;
+  left = right = points[0];
+  top = bottom = points[1];
+  for (i = 1; i < n; i++)
+    {
+      if (points[2 * i] < left)
+	left = points[2 * i];
+      if (points[2 * i] > right)
+	right = points[2 * i];
+      if (points[2 * i + 1] < top)
+	top = points[2 * i + 1];
+      if (points[2 * i + 1] > bottom)
+	bottom = points[2 * i + 1];
+    }
+
+  for (y = top; y < bottom; y++)
+    for (x = left; x <= right; x++)
+      {
+	bool inside = false;
+
+	for (i = 0; i < n; i++)
+	  {
+	    const int16_t *a = &points[2 * i];
+	    const int16_t *b = &points[2 * ((i + 1) % n)];
+	    int32_t dy, num;
+
+	    if (a[1] > b[1])
+	      {
+		const int16_t *t = a;
+		a = b;
+		b = t;
+	      }
+	    if (y < a[1] || y >= b[1])
+	      continue;
+	    dy = b[1] - a[1];
+	    num = 2L * a[0] * dy + (2L * (y - a[1]) + 1) * (b[0] - a[0]) - dy;
+	    if (2L * dy * x >= num)
+	      inside = !inside;
+	  }
+	if (inside)
+	  plot (x, y, color);
+      }
+}
+
+void
+naiveFillRect (int16_t x, int16_t y, int16_t w, int16_t h, uint8_t color)
+{
+  int16_t i, j;
+
+  for (j = y; j < y + h; j++)
+    for (i = x; i < x + w; i++)
+      plot (i, j, color);
+}
+
+/* Draw a gauge: a dial, its scale, a needle and a bar graph, with the
+   driver geometry if FAST, else pixel by pixel.  Both draw the same
+   picture.  Returns the time it took in microseconds.  */
+
+uint32_t
+drawGauge (bool fast)
+{
+  int16_t cx = width () / 2, cy = height () / 2;
+  int16_t r = (width () < height () ? width () : height ()) / 2 - 4;
+  const int16_t needle[] = { cx, (int16_t) (cy - 3), (int16_t) (cx + r - 8),
+			     cy, cx, (int16_t) (cy + 3) };
+  uint32_t start = micros ();
+  int16_t a, i;
+
+  if (fast)
+    {
+      fillCircle (cx, cy, r, 0x20);
+      drawCircle (cx, cy, r, 0x0f);
+      drawArc (cx, cy, r - 4, 135, 405, 0x0e);
+    }
+  else
+    {
+      naiveFillCircle (cx, cy, r, 0x20);
+      naiveCircle (cx, cy, r, 0x0f);
+      naiveArc (cx, cy, r - 4, 135, 405, 0x0e);
+    }
+  for (a = 135; a <= 405; a += 27)
+    (fast ? drawLine : naiveLine) (cx + (r - 4) * cos (a * M_PI / 180),
+				   cy + (r - 4) * sin (a * M_PI / 180),
+				   cx + (r - 12) * cos (a * M_PI / 180),
+				   cy + (r - 12) * sin (a * M_PI / 180), 0x0e);
+  if (fast)
+    fillPolygon (needle, 3, 0x4c);
+  else
+    naiveFillPolygon (needle, 3, 0x4c);
+  for (i = 0; i < 8; i++)
+    if (fast)
+      fillRectangle (cx - 40 + i * 10, cy + r / 2 - i * 3, cx - 32 + i * 10,
+		     cy + r / 2 + 10, 0x5a);
+    else
+      naiveFillRect (cx - 40 + i * 10, cy + r / 2 - i * 3, 8, 10 + i * 3,
+		     0x5a);
+  return micros () - start;
+}
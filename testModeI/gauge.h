@@ -0,0 +1,29 @@
+#ifndef __GAUGE_H__
+#define __GAUGE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifndef bool
+# include <stdbool.h>
+#endif
+
+void naiveLine (int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+		uint8_t color);
+void naiveCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color);
+void naiveArc (int16_t cx, int16_t cy, uint16_t r, int16_t start,
+	       int16_t end, uint8_t color);
+void naiveFillCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color);
+void naiveFillPolygon (const int16_t *points, uint8_t n, uint8_t color);
+void naiveFillRect (int16_t x, int16_t y, int16_t w, int16_t h,
+		    uint8_t color);
+uint32_t drawGauge (bool fast);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
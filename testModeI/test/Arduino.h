@@ -0,0 +1,28 @@
+/* Just enough of Arduino.h to build the driver on the host, for the
+   checks in this directory.  The pins and the clock are those of the
+   chip model in vs23sim.c.  */
+
+#ifndef __ARDUINO_HOST_H__
+#define __ARDUINO_HOST_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOW 0
+#define HIGH 1
+
+void digitalWrite (int pin, int value);
+int digitalRead (int pin);
+void delay (unsigned long ms);
+unsigned long micros (void);
+unsigned long millis (void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+/* Host check of colorFromRgb: the table lookup must give the same
+   colour as the chain of comparisons it replaced, for all 2^24 RGB
+   colours.  Build and run from this directory against any copy of
+   the driver, e.g.
+
+     cc -O2 -I. -I.. -o colorFromRgb colorFromRgb.c vs23sim.c -lm \
+       && ./colorFromRgb  */
+
+#include <stdio.h>
+
+#include "vs23s0x0.c"
+
+/* colorFromRgb as it was before the table.  */
+
+static uint8_t
+colorFromRgbBranches (uint8_t r, uint8_t g, uint8_t b)
+{
+  uint8_t hue = (YYRGB(r, g, b) >> 4) & 0x0f;
+
+  if (r >= b && b > g)
+    return (ROW_RB * 16 + hue);
+
+  if (r >= g && g > b)
+    return (ROW_RG * 16 + hue);
+
+  if (b >= r && r > g)
+    return (ROW_BR * 16 + hue);
+
+  if (b >= g && g > r)
+    return (ROW_BG * 16 + hue);
+
+  if (g >= b && b > r)
+    return (ROW_GB * 16 + hue);
+
+  if (g >= r && r > b)
+    return (ROW_GR * 16 + hue);
+
+  if (r > b && r > g)
+    return (ROW_R * 16 + hue);
+
+  if (b > r && b > g)
+    return (ROW_B * 16 + hue);
+
+  if (g > r && g > b)
+    return (ROW_G * 16 + hue);
+
+  return (ROW_BW * 16 + hue);
+}
+
+int
+main (void)
+{
+  uint32_t rgb, bad = 0;
+
+  for (rgb = 0; rgb < 1UL << 24; rgb++)
+    {
+      uint8_t r = rgb >> 16, g = rgb >> 8, b = rgb;
+      uint8_t want = colorFromRgbBranches (r, g, b);
+      uint8_t got = colorFromRgb (r, g, b);
+
+      if (got != want && bad++ < 16)
+	printf ("%02x%02x%02x: %02x, want %02x\n", r, g, b, got, want);
+    }
+  printf ("%lu of %lu colours differ\n", (unsigned long) bad, 1UL << 24);
+  return bad != 0;
+}
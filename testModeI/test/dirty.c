@@ -0,0 +1,158 @@
+/* Host check of the dirty rectangle tracking:
+
+   - the damage MoveBlock records covers every pixel it changes,
+     forwards and in reverse, with and without skips;
+   - areas that are cheaper to repaint together are merged, far apart
+     ones are not, and dirtyRects merges down to as many as asked for
+     without losing any damage;
+   - large areas are repainted with block moves if the application
+     can, single lines with write bursts.
+
+   Build and run from this directory against any copy of the driver,
+   e.g.
+
+     cc -O2 -I. -I.. -o dirty dirty.c ../vs23s0x0.c vs23sim.c -lm \
+       && ./dirty  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vs23s0x0.h"
+#include "vs23sim.h"
+
+static uint8_t m_before[SIM_SRAM_SIZE];
+static int m_failed;
+
+static void
+check (bool ok, const char *what)
+{
+  printf ("%s: %s\n", ok ? "ok" : "FAILED", what);
+  if (!ok)
+    m_failed = 1;
+}
+
+static bool
+covered (const struct dirty_rect_t *r, uint8_t n, uint16_t x, uint16_t y)
+{
+  uint8_t i;
+
+  for (i = 0; i < n; i++)
+    if (x >= r[i].x && x < r[i].x + r[i].w && y >= r[i].y
+	&& y < r[i].y + r[i].h)
+      return true;
+  return false;
+}
+
+/* Move with MoveBlock after filling the frame buffer with a pattern,
+   true if the damage covers all pixels that changed.  */
+
+static bool
+moveDamage (uint16_t x_src, uint16_t y_src, uint16_t x_dst, uint16_t y_dst,
+	    uint8_t w, uint8_t h, uint8_t dir)
+{
+  const struct mem_layout_t *l = currentLayout ();
+  struct dirty_rect_t r[16];
+  uint32_t a;
+  uint16_t x, y;
+  uint8_t n;
+
+  for (a = 0; a < l->frame_bytes; a++)
+    simSram[l->picline_start + a] = a * 7 + a / 251;
+  memcpy (m_before, simSram, SIM_SRAM_SIZE);
+  dirtyClear ();
+  MoveBlock (x_src, y_src, x_dst, y_dst, w, h, dir);
+  n = dirtyRects (r, 16);
+  for (y = 0; y < height (); y++)
+    for (x = 0; x < width (); x++)
+      {
+	a = l->picline_start + (uint32_t) l->pitch * y + x;
+	if (simSram[a] != m_before[a] && !covered (r, n, x, y))
+	  return false;
+      }
+  return true;
+}
+
+static void
+checkMoves (void)
+{
+  uint16_t w = width (), h = height ();
+
+  check (moveDamage (10, 10, 40, 30, 20, 15, 0), "forward move");
+  check (moveDamage (29, 24, 59, 44, 20, 15, 1), "reverse move");
+  check (moveDamage (0, 0, 8, 5, 16, 4, 2), "forward move, no skip, "
+	 "within a line");
+  check (moveDamage (0, 0, w - 40, 5, 32, 4, 2), "forward move, no skip, "
+	 "over lines");
+  check (moveDamage (100, 50, 100, 60, 16, 2, 3), "reverse move, no skip, "
+	 "within a line");
+  check (moveDamage (w - 1, h - 1, 20, h - 20, 64, 10, 3), "reverse move, "
+	 "no skip, over lines");
+  check (moveDamage (w - 1, h - 1, 3, 2, 200, 20, 3), "reverse move, "
+	 "no skip, past the top");
+}
+
+static void
+checkMerge (void)
+{
+  struct dirty_rect_t r[16];
+  uint8_t n;
+
+  dirtyClear ();
+  dirtyAdd (10, 10, 8, 8);
+  dirtyAdd (20, 10, 8, 8);
+  n = dirtyRects (r, 16);
+  check (n == 1 && r[0].x == 10 && r[0].w == 18 && r[0].h == 8,
+	 "neighbours merged");
+
+  dirtyAdd (12, 12, 4, 4);
+  check (dirtyRects (r, 16) == 1, "damage inside an area absorbed");
+
+  dirtyClear ();
+  dirtyAdd (0, 0, 8, 8);
+  dirtyAdd (width () - 8, height () - 8, 8, 8);
+  check (dirtyRects (r, 16) == 2, "far apart areas kept apart");
+
+  dirtyClear ();
+  dirtyAdd (0, 0, 8, 8);
+  dirtyAdd (width () - 8, 0, 8, 8);
+  dirtyAdd (0, height () - 8, 8, 8);
+  dirtyAdd (width () - 8, height () - 8, 8, 8);
+  n = dirtyRects (r, 2);
+  check (n <= 2 && covered (r, n, 0, 0) && covered (r, n, width () - 1, 0)
+	 && covered (r, n, 0, height () - 1)
+	 && covered (r, n, width () - 1, height () - 1),
+	 "merged down to at most the number asked for");
+}
+
+static void
+checkCost (void)
+{
+  struct dirty_rect_t r[16];
+
+  dirtyBegin (true);
+  dirtyAdd (0, 0, 120, 120);
+  check (dirtyRects (r, 16) == 1 && r[0].blit, "large area blitted");
+  dirtyClear ();
+  dirtyAdd (0, 0, 8, 1);
+  check (dirtyRects (r, 16) == 1 && !r[0].blit, "short line written");
+
+  dirtyBegin (false);
+  dirtyAdd (0, 0, 120, 120);
+  check (dirtyRects (r, 16) == 1 && !r[0].blit,
+	 "written if the application cannot blit");
+}
+
+int
+main (void)
+{
+  videoBegin (false, true, 1);
+  waitVideoReady ();
+  clearScreenFlush ();
+
+  dirtyBegin (false);
+  checkMoves ();
+  checkMerge ();
+  checkCost ();
+  dirtyEnd ();
+  return m_failed;
+}
@@ -0,0 +1,58 @@
+/* Host benchmark of drawGauge: the SPI transactions, bytes and block
+   moves of the gauge pixel by pixel and with the driver geometry, and
+   the time they take on the chip model, one microsecond per byte.
+   Both must draw the same picture.
+
+   Build and run from this directory against any copy of the driver,
+   e.g.
+
+     cc -O2 -I. -I.. -o gaugeCount gaugeCount.c ../vs23s0x0.c \
+       ../gauge.c vs23sim.c -lm && ./gaugeCount  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vs23s0x0.h"
+#include "gauge.h"
+#include "vs23sim.h"
+
+static uint8_t m_naive[SIM_SRAM_SIZE];
+
+static void
+count (const char *what, bool fast)
+{
+  const struct mem_layout_t *l = currentLayout ();
+  uint32_t transactions = simTransactions;
+  uint32_t bytes = simBytes;
+  uint32_t moves = simMoves;
+  uint32_t us;
+
+  memset (&simSram[l->picline_start], 0, l->frame_bytes);
+  us = drawGauge (fast);
+  printf ("%-10s %8lu %8lu %6lu %8lu\n", what,
+	  (unsigned long) (simTransactions - transactions),
+	  (unsigned long) (simBytes - bytes),
+	  (unsigned long) (simMoves - moves), (unsigned long) us);
+}
+
+int
+main (void)
+{
+  const struct mem_layout_t *l;
+  bool same;
+
+  videoBegin (false, true, 1);
+  waitVideoReady ();
+  clearScreenFlush ();
+  l = currentLayout ();
+
+  printf ("%4ux%-5u %8s %8s %6s %8s\n", width (), height (),
+	  "transact", "bytes", "moves", "usec");
+  count ("per pixel", false);
+  memcpy (m_naive, simSram, SIM_SRAM_SIZE);
+  count ("geometry", true);
+  same = !memcmp (&m_naive[l->picline_start], &simSram[l->picline_start],
+		  l->frame_bytes);
+  printf ("same picture: %s\n", same ? "yes" : "no");
+  return !same;
+}
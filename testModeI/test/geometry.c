@@ -0,0 +1,153 @@
+/* Host check of the driver geometry: drawLine, drawCircle, drawArc,
+   fillCircle, fillPolygon and fillRectangle must set the same pixels
+   as the per-pixel versions in gauge.c, for shapes of all sizes,
+   partly off the screen as well.  fillCircle and fillPolygon fill
+   with fillBlock, so blocks of every width and height are covered.
+
+   Build and run from this directory against any copy of the driver,
+   e.g.
+
+     cc -O2 -I. -I.. -o geometry geometry.c ../vs23s0x0.c ../gauge.c \
+       vs23sim.c -lm && ./geometry  */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "vs23s0x0.h"
+#include "gauge.h"
+#include "vs23sim.h"
+
+#define SHAPES 400
+
+static uint8_t m_fast[SIM_SRAM_SIZE];
+static uint32_t m_seed = 1;
+static uint32_t m_failed;
+
+static int16_t
+randomIn (int16_t lo, int16_t hi)
+{
+  m_seed = m_seed * 1103515245 + 12345;
+  return lo + (int16_t) ((m_seed >> 8) % (uint32_t) (hi - lo + 1));
+}
+
+static void
+clearFrame (void)
+{
+  const struct mem_layout_t *l = currentLayout ();
+
+  memset (&simSram[l->picline_start], 0, l->frame_bytes);
+}
+
+/* Compare the frame buffer against the one saved in m_fast.  */
+
+static void
+compare (const char *what, int k)
+{
+  const struct mem_layout_t *l = currentLayout ();
+  uint32_t a;
+
+  for (a = 0; a < l->frame_bytes; a++)
+    if (simSram[l->picline_start + a] != m_fast[l->picline_start + a])
+      {
+	if (m_failed++ < 16)
+	  printf ("%s %d: pixel (%lu, %lu) differs\n", what, k,
+		  (unsigned long) (a % l->pitch),
+		  (unsigned long) (a / l->pitch));
+	return;
+      }
+}
+
+/* Draw shape K of kind WHAT with the driver if FAST, else pixel by
+   pixel, from the same random numbers.  */
+
+static void
+drawShape (int what, int k, bool fast)
+{
+  int16_t w = width (), h = height ();
+  int16_t x, y, r, p[8];
+  uint8_t i, n;
+
+  m_seed = what * 1000003UL + k;
+  switch (what)
+    {
+    case 0:
+      x = randomIn (-20, w + 20);
+      y = randomIn (-20, h + 20);
+      p[0] = randomIn (-20, w + 20);
+      p[1] = randomIn (-20, h + 20);
+      (fast ? drawLine : naiveLine) (x, y, p[0], p[1], 0x4c);
+      break;
+    case 1:
+      x = randomIn (-20, w + 20);
+      y = randomIn (-20, h + 20);
+      r = randomIn (0, 80);
+      (fast ? drawCircle : naiveCircle) (x, y, r, 0x0f);
+      break;
+    case 2:
+      x = randomIn (-20, w + 20);
+      y = randomIn (-20, h + 20);
+      r = randomIn (0, 80);
+      p[0] = randomIn (-400, 400);
+      p[1] = randomIn (-400, 400);
+      (fast ? drawArc : naiveArc) (x, y, r, p[0], p[1], 0x0e);
+      break;
+    case 3:
+      x = randomIn (-20, w + 20);
+      y = randomIn (-20, h + 20);
+      r = randomIn (0, 100);
+      (fast ? fillCircle : naiveFillCircle) (x, y, r, 0x20);
+      break;
+    case 4:
+      n = randomIn (3, 4);
+      for (i = 0; i < n; i++)
+	{
+	  p[2 * i] = randomIn (-20, w + 20);
+	  p[2 * i + 1] = randomIn (-20, h + 20);
+	}
+      (fast ? fillPolygon : naiveFillPolygon) (p, n, 0x5a);
+      break;
+    case 5:
+      // fillRectangle takes 2 lines and more, and does not clip.
+      p[0] = randomIn (1, 64);
+      p[1] = randomIn (2, 40);
+      x = randomIn (0, w - p[0]);
+      y = randomIn (0, h - p[1]);
+      if (fast)
+	fillRectangle (x, y, x + p[0], y + p[1], 0x94);
+      else
+	naiveFillRect (x, y, p[0], p[1], 0x94);
+      break;
+    }
+}
+
+int
+main (void)
+{
+  static const char *name[] = {
+    "drawLine", "drawCircle", "drawArc", "fillCircle", "fillPolygon",
+    "fillRectangle"
+  };
+  int what, k;
+
+  videoBegin (false, true, 1);
+  waitVideoReady ();
+  clearScreenFlush ();
+
+  for (what = 0; what < 6; what++)
+    {
+      uint32_t failed = m_failed;
+
+      for (k = 0; k < SHAPES; k++)
+	{
+	  clearFrame ();
+	  drawShape (what, k, true);
+	  memcpy (m_fast, simSram, SIM_SRAM_SIZE);
+	  clearFrame ();
+	  drawShape (what, k, false);
+	  compare (name[what], k);
+	}
+      printf ("%s: %lu of %d shapes differ\n", name[what],
+	      (unsigned long) (m_failed - failed), SHAPES);
+    }
+  return m_failed != 0;
+}
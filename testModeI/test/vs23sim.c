@@ -0,0 +1,208 @@
+/* The VS23S010 model of vs23sim.h, behind the pin and SPI functions
+   the driver calls.  */
+
+#include "Arduino.h"
+#include "vs23s0x0-hal.h"
+#include "vs23sim.h"
+
+#define SIM_WRITE_SRAM 0x02
+#define SIM_READ_SRAM 0x03
+#define SIM_BLOCKMVC1 0x34
+#define SIM_BLOCKMVC2 0x35
+#define SIM_BLOCKMV_S 0x36
+#define SIM_CURLINE 0x53
+
+uint8_t simSram[SIM_SRAM_SIZE];
+uint16_t simRegister[256];
+uint32_t simTransactions;
+uint32_t simBytes;
+uint32_t simMoves;
+unsigned long simMicros;
+uint16_t simMoveByteNs = 250;
+uint16_t simLines = 313;
+uint32_t simLineNs = 64000;
+
+/// The transaction going on: the first bytes of it and how many
+/// there were so far
+static bool m_selected;
+static uint8_t m_head[6];
+static uint32_t m_count;
+
+/// Block mover setup of BLOCKMVC1 and BLOCKMVC2
+static uint16_t m_move_src;
+static uint16_t m_move_dst;
+static uint8_t m_move_flags;
+static uint16_t m_move_skip;
+static uint8_t m_move_width;
+static uint8_t m_move_height;
+/// simMicros when the block mover is done
+static unsigned long m_move_done;
+
+static inline uint32_t
+headAddr (void)
+{
+  return ((uint32_t) m_head[1] << 16) | (m_head[2] << 8) | m_head[3];
+}
+
+static void
+blockMove (void)
+{
+  uint32_t src = (uint32_t) m_move_src << 1 | ((m_move_flags >> 2) & 1);
+  uint32_t dst = (uint32_t) m_move_dst << 1 | ((m_move_flags >> 1) & 1);
+  int step = (m_move_flags & 1) ? -1 : 1;
+  uint16_t y, x;
+
+  simMoves++;
+  m_move_done = simMicros + ((uint32_t) m_move_width * (m_move_height + 1)
+			     * simMoveByteNs + 999) / 1000;
+  for (y = 0; y <= m_move_height; y++)
+    {
+      for (x = 0; x < m_move_width; x++)
+	{
+	  simSram[dst % SIM_SRAM_SIZE] = simSram[src % SIM_SRAM_SIZE];
+	  src += step;
+	  dst += step;
+	}
+      src += step * m_move_skip;
+      dst += step * m_move_skip;
+    }
+}
+
+/* Run what the bytes of the transaction ask for, once it ends.  */
+
+static void
+endTransaction (void)
+{
+  simTransactions++;
+  if (m_count == 0)
+    return;
+  switch (m_head[0])
+    {
+    case SIM_WRITE_SRAM:
+    case SIM_READ_SRAM:
+    case SIM_CURLINE:
+      break;
+    case SIM_BLOCKMVC1:
+      m_move_src = (m_head[1] << 8) | m_head[2];
+      m_move_dst = (m_head[3] << 8) | m_head[4];
+      // The flags byte is left out when it does not change.
+      if (m_count > 5)
+	m_move_flags = m_head[5];
+      break;
+    case SIM_BLOCKMVC2:
+      m_move_skip = (m_head[1] << 8) | m_head[2];
+      m_move_width = m_head[3];
+      m_move_height = m_head[4];
+      break;
+    case SIM_BLOCKMV_S:
+      blockMove ();
+      break;
+    default:
+      if (m_count >= 3)
+	simRegister[m_head[0]] = (m_head[1] << 8) | m_head[2];
+      else if (m_count == 2)
+	simRegister[m_head[0]] = m_head[1];
+      break;
+    }
+}
+
+/* Shift OUT to the chip, returns the byte that comes back.  */
+
+static uint8_t
+shift (uint8_t out)
+{
+  uint8_t in = 0;
+
+  simBytes++;
+  simMicros++;
+  if (!m_selected)
+    return 0;
+  if (m_count < sizeof (m_head))
+    m_head[m_count] = out;
+  if (m_count >= 4 && m_head[0] == SIM_WRITE_SRAM)
+    simSram[(headAddr () + m_count - 4) % SIM_SRAM_SIZE] = out;
+  else if (m_count >= 4 && m_head[0] == SIM_READ_SRAM)
+    in = simSram[(headAddr () + m_count - 4) % SIM_SRAM_SIZE];
+  else if (m_count >= 1 && m_count <= 2 && m_head[0] == SIM_CURLINE)
+    {
+      uint16_t line = (uint64_t) simMicros * 1000 / simLineNs % simLines;
+
+      in = m_count == 1 ? line >> 8 : line;
+    }
+  m_count++;
+  return in;
+}
+
+void
+digitalWrite (int pin, int value)
+{
+  if (pin != VS23_CS_PIN)
+    return;
+  if (value == LOW)
+    {
+      m_selected = true;
+      m_count = 0;
+    }
+  else if (m_selected)
+    {
+      m_selected = false;
+      endTransaction ();
+    }
+}
+
+int
+digitalRead (int pin)
+{
+  if (pin == VS23_MVBLK_PIN)
+    return (long) (simMicros++ - m_move_done) < 0 ? HIGH : LOW;
+  return LOW;
+}
+
+void
+delay (unsigned long ms)
+{
+  simMicros += ms * 1000;
+}
+
+unsigned long
+micros (void)
+{
+  return simMicros++;
+}
+
+unsigned long
+millis (void)
+{
+  return simMicros++ / 1000;
+}
+
+uint8_t
+spi_transfer (uint8_t data)
+{
+  return shift (data);
+}
+
+uint16_t
+spi_transfer16 (uint16_t data)
+{
+  uint8_t hi = shift (data >> 8);
+
+  return (hi << 8) | shift (data);
+}
+
+void
+spi_transfer24 (uint32_t data)
+{
+  shift (data >> 16);
+  shift (data >> 8);
+  shift (data);
+}
+
+void
+spi_transfer32 (uint32_t data)
+{
+  shift (data >> 24);
+  shift (data >> 16);
+  shift (data >> 8);
+  shift (data);
+}
@@ -0,0 +1,42 @@
+/* A model of one VS23S010 on the SPI bus, for the host checks in this
+   directory: SRAM writes and reads, the block mover and the current
+   line, on a clock that counts SPI bytes.  Block moves copy at once
+   but keep the block mover busy for their time.  Other registers are
+   only stored.  */
+
+#ifndef __VS23SIM_H__
+#define __VS23SIM_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_SRAM_SIZE 131072
+
+extern uint8_t simSram[SIM_SRAM_SIZE];
+extern uint16_t simRegister[256];
+
+/// Since the start: SPI transactions, bytes on the bus and block moves
+extern uint32_t simTransactions;
+extern uint32_t simBytes;
+extern uint32_t simMoves;
+
+/// Time of micros(), one microsecond per SPI byte and per call of
+/// micros, millis or digitalRead, so that polling loops end
+extern unsigned long simMicros;
+
+/// Time the block mover takes per byte, in ns
+extern uint16_t simMoveByteNs;
+
+/// Scan lines per frame and their length in ns, for the current line;
+/// PAL by default
+extern uint16_t simLines;
+extern uint32_t simLineNs;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,10 +1,12 @@
 #include "Arduino.h"
 #include "tms9918.h"
+#include "vs23s0x0.h"
 #include "vs23s0x0-hal.h"
 #include <SPI.h>
 
 #include "font-8x8.h"
 #include "ball.h"
+#include "gauge.h"
 
 uint8_t spi_transfer (uint8_t a)
 {
@@ -43,6 +45,30 @@ static inline void videoConfigPins (void)
   SPI.setBitOrder (MSBFIRST);
 }
 
+/* Draw a BENCH_TILE_W x BENCH_TILE_H tile over the screen, from RGB
+   colours through drawBitmapRgb888 if RGB, else from colours as they
+   are stored.  Returns the time it took in microseconds, the
+   difference between the two is the cost of colorFromRgb.  */
+
+#define BENCH_TILE_W 32
+#define BENCH_TILE_H 16
+
+static uint8_t tileRgb[BENCH_TILE_W * BENCH_TILE_H * 3];
+static uint8_t tileYuv[BENCH_TILE_W * BENCH_TILE_H];
+
+static uint32_t drawRgbTiles (bool rgb)
+{
+  uint32_t start = micros ();
+
+  for (uint16_t y = 0; y + BENCH_TILE_H <= height (); y += BENCH_TILE_H)
+    for (uint16_t x = 0; x + BENCH_TILE_W <= width (); x += BENCH_TILE_W)
+      if (rgb)
+	drawBitmapRgb888 (x, y, BENCH_TILE_W, BENCH_TILE_H, tileRgb, 0);
+      else
+	drawBitmapYuv (x, y, BENCH_TILE_W, BENCH_TILE_H, tileYuv, 0);
+  return micros () - start;
+}
+
 void setup () {
   unsigned char *font = (unsigned char *)console_font_8x8;
 
@@ -55,6 +81,14 @@ void setup () {
   videoConfigPins();
   tms9918aInit ();
 
+  const struct mem_layout_t *layout = currentLayout ();
+  Serial.print (F("Frame buffer bytes: "));
+  Serial.println (layout->frame_bytes);
+  Serial.print (F("Free SRAM bytes: "));
+  Serial.println (layout->free_bytes);
+  Serial.print (F("Extra frame buffers: "));
+  Serial.println (layout->extra_frames);
+
   /* 1. Initialize Text Mode.  */
   tms9918aWriteReg (0, 0);    /* Text mode, no external video.  */
   tms9918aWriteReg (1, 0xc0); /* 16k, enable disp, disable int.  */
@@ -113,6 +147,8 @@ void loop () {
   Serial.read();
 #endif
 
+  /* Cycle the colours every 10 frames.  */
+  uint32_t missed = 0;
   while (Serial.available () == 0)
     {
       tms9918aWriteAddr (0xc00);
@@ -123,7 +159,44 @@ void loop () {
 	  tms9918aWriteData ((val << 4) | i%16 );
 	}
       tms9918aDisplay ();
+      missed += frameSync (10);
+    }
+  Serial.read();
+  Serial.print(F("Missed frames: "));
+  Serial.println(missed);
+
+  /* Driver geometry against drawing pixel by pixel.  */
+  uint32_t naive = drawGauge (false);
+  uint32_t fast = drawGauge (true);
+  Serial.print(F("Gauge per pixel [usec]: "));
+  Serial.println(naive);
+  Serial.print(F("Gauge with geometry [usec]: "));
+  Serial.println(fast);
+  delay(1);
+  while (Serial.available() == 0) {};
+  Serial.read();
+
+  /* colorFromRgb over a tile of hues and greys.  */
+  for (uint16_t i = 0; i < BENCH_TILE_W * BENCH_TILE_H; i++)
+    {
+      tileRgb[i * 3] = i * 7;
+      tileRgb[i * 3 + 1] = (i % 3) ? i * 13 : i * 7;
+      tileRgb[i * 3 + 2] = (i % 5) ? i * 29 : i * 7;
+      tileYuv[i] = i;
     }
+  uint32_t plain = drawRgbTiles (false);
+  uint32_t conv = drawRgbTiles (true);
+  uint32_t pixels = (uint32_t) (width () / BENCH_TILE_W) * BENCH_TILE_W
+    * (height () / BENCH_TILE_H) * BENCH_TILE_H;
+  Serial.print(F("Tiles in ready colours [usec]: "));
+  Serial.println(plain);
+  Serial.print(F("Tiles from RGB888 [usec]: "));
+  Serial.println(conv);
+  Serial.print(F("colorFromRgb per pixel [nsec]: "));
+  // Signed, conversion may come out ahead on a noisy run.
+  Serial.println((int32_t) (conv - plain) * 1000 / (int32_t) pixels);
+  delay(1);
+  while (Serial.available() == 0) {};
   Serial.read();
 
   Serial.println(F("End of test! [Restart press key]"));
@@ -19,12 +19,52 @@ struct video_mode_t {
   uint16_t left;
   uint8_t vclkpp;
   uint8_t bextra;
+  uint8_t vrep;		// scan lines per picture line, 0 is the same as 1
+  bool fieldlines;	// Interlaced, the fields show alternate lines
 };
 
 extern const struct video_mode_t *m_current_mode;
 
+/// SRAM layout of a mode, see planLayout.  Addresses and sizes are
+/// in bytes.
+struct mem_layout_t {
+  uint8_t protolines;
+  uint16_t proto_bytes;		// Protolines start at address 0
+  uint32_t index_start;
+  uint16_t index_bytes;
+  uint32_t picline_start;
+  uint16_t picline_bytes;	// Picture line length without bextra
+  uint8_t bextra;
+  uint16_t pitch;		// Distance between picture lines
+  uint16_t piclines;
+  uint16_t max_piclines;	// Picture lines that would fit
+  uint32_t frame_bytes;
+  uint32_t free_start;		// First byte handed out by sramAlloc
+  uint32_t free_bytes;
+  uint16_t extra_frames;	// Further frame buffers that would fit
+};
+
+/// A rectangular pixel area in VS23 SRAM, lines are pitch bytes apart.
+struct surface_t {
+  uint32_t base;
+  uint16_t pitch;
+  uint16_t width;
+  uint16_t height;
+};
+
+/// A damaged area of the draw surface, see dirtyRects.  BLIT is set
+/// if repainting it with block moves is cheaper than with write bursts.
+struct dirty_rect_t {
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+  bool blit;
+};
+
 #define XPIXELS (m_current_mode->x)
 #define YPIXELS (m_current_mode->y)
+#define LINEREP (m_current_mode->vrep ? m_current_mode->vrep : 1)
 
 inline uint16_t width (void)
 {
@@ -36,31 +76,119 @@ inline uint16_t height (void)
   return YPIXELS;
 }
 
+inline uint8_t lineRepeat (void)
+{
+  return LINEREP;
+}
+
 void SpiRamWriteRegister (uint16_t, uint16_t);
 uint16_t SpiRamReadRegister (uint16_t);
 
 uint16_t currentLine();
+uint16_t beamLine(void);
+void beamSync(void);
+uint32_t frameMicros(void);
+void setFrameCallback(void (*callback)(void));
+bool pollFrame(void);
+void waitVsync(void);
+uint32_t frameCount(void);
+uint16_t frameSync(uint8_t period);
+void chaseBeam(uint16_t first, uint16_t count, void (*write)(uint16_t y));
+void deferBegin(void);
+void deferEnd(void);
+bool deferCall(void (*run)(uint32_t, uint32_t), uint32_t a, uint32_t b,
+	       uint16_t bytes);
+void setDeferBudget(uint16_t us);
+uint8_t deferPending(void);
+void deferFlush(void);
 
 void setColorSpace(uint8_t palette);
 
+bool planLayout(const struct video_mode_t *mode, bool pal, bool interlace,
+		struct mem_layout_t *layout);
+const struct mem_layout_t *currentLayout(void);
 bool setMode(uint8_t);
+bool makeMode(uint16_t width, uint16_t height, uint8_t vclkpp, uint8_t vrep,
+	      struct video_mode_t *mode);
+bool setCustomMode(const struct video_mode_t *mode);
+bool changeMode(const struct video_mode_t *mode, bool keep);
+bool videoReady(void);
+void waitVideoReady(void);
 void setSyncLine(uint16_t line);
 
 void videoBegin (bool, bool, uint8_t);
 void videoInit (uint8_t);
+void setDisplays(uint8_t channels);
+uint8_t selectChannels(uint8_t channels);
 void SetLineIndex(uint16_t line, uint16_t wordAddress);
 void SetPicIndex(uint16_t line, uint32_t byteAddress, uint16_t protoAddress);
+void mapPicLines(uint16_t first, uint16_t lines, bool flip);
+
+int8_t createPicBuffer(uint16_t pitch, uint16_t lines);
+bool bindPicBuffer(uint16_t first, uint16_t count, uint8_t buf, uint16_t y);
+void scrollPicBuffer(uint8_t buf, uint16_t y);
+void selectPicBuffer(uint8_t buf);
+
+uint32_t sramAlloc(uint32_t size);
+void sramFree(uint32_t addr);
+uint32_t sramFreeBytes(void);
+void sramWrite(uint8_t channel, uint32_t address, const uint8_t *data,
+	       uint16_t n);
+void sramRead(uint8_t channel, uint32_t address, uint8_t *data, uint16_t n);
+void sramCopy(uint8_t from, uint32_t src, uint8_t to, uint32_t dst,
+	      uint32_t n);
+
+bool surfaceCreate(struct surface_t *s, uint16_t width, uint16_t height,
+		   uint16_t pitch);
+void surfaceDestroy(struct surface_t *s);
+void setDrawSurface(const struct surface_t *s);
 void setBorder(uint8_t y, uint8_t uv);
 
 void setPixelYuv(uint16_t, uint16_t, uint8_t);
 void setPixelRgb(uint16_t, uint16_t, uint8_t, uint8_t, uint8_t);
+void drawHSpan(uint16_t x, uint16_t y, uint16_t len, uint8_t color);
+void writeSpan(uint16_t x, uint16_t y, const uint8_t *pixels, uint16_t len);
+void drawVSpan(uint16_t x, uint16_t y, uint16_t len, uint8_t color);
+void drawBitmapYuv(int16_t x, int16_t y, uint16_t w, uint16_t h,
+		   const uint8_t *pixels, uint16_t stride);
+void drawBitmap1(int16_t x, int16_t y, uint16_t w, uint16_t h,
+		 const uint8_t *bits, uint16_t stride, uint8_t fg, uint8_t bg);
+void drawBitmap4(int16_t x, int16_t y, uint16_t w, uint16_t h,
+		 const uint8_t *pixels, uint16_t stride,
+		 const uint8_t *palette);
+void drawBitmapRgb888(int16_t x, int16_t y, uint16_t w, uint16_t h,
+		      const uint8_t *pixels, uint16_t stride);
+void drawBitmapRgb565(int16_t x, int16_t y, uint16_t w, uint16_t h,
+		      const uint16_t *pixels, uint16_t stride);
 void clearScreen (uint8_t colour);
+bool clearScreenPoll (void);
+void clearScreenFlush (void);
 
 void MoveBlock (uint16_t, uint16_t, uint16_t, uint16_t, uint8_t,
 		uint8_t, uint8_t);
 void blitRect (uint16_t, uint16_t, uint16_t, uint16_t, uint8_t,
 	       uint8_t);
+void blitSurface (const struct surface_t *, uint16_t, uint16_t,
+		  const struct surface_t *, uint16_t, uint16_t,
+		  uint8_t, uint8_t);
 void fillRectangle (uint16_t, uint16_t, uint16_t, uint16_t, uint8_t);
+void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color);
+void drawCircle(int16_t cx, int16_t cy, uint16_t r, uint8_t color);
+void drawArc(int16_t cx, int16_t cy, uint16_t r, int16_t start, int16_t end,
+	     uint8_t color);
+void fillCircle(int16_t cx, int16_t cy, uint16_t r, uint8_t color);
+void fillPolygon(const int16_t *points, uint8_t n, uint8_t color);
+bool glyphCacheBegin(uint8_t width, uint8_t height, uint16_t slots);
+void glyphCacheEnd(void);
+void glyphCacheClear(void);
+void glyphCacheForget(uint16_t glyph);
+void drawGlyph(uint16_t x, uint16_t y, uint16_t glyph, const uint8_t *bits,
+	       uint8_t w, uint8_t h, uint8_t fg, uint8_t bg);
+void dirtyBegin(bool blit);
+void dirtyEnd(void);
+void dirtyAdd(uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+uint8_t dirtyRects(struct dirty_rect_t *rects, uint8_t max);
+void dirtyClear(void);
 void reset(void);
 
 #ifdef __cplusplus
@@ -1,5 +1,6 @@
 #include "Arduino.h"
 #include "tms9918.h"
+#include "vs23s0x0.h"
 #include "vs23s0x0-hal.h"
 #include <SPI.h>
 #include "bird.h"
@@ -51,6 +52,7 @@ void setup () {
 
   videoConfigPins();
   tms9918aInit ();
+  setMode (4);  /* 64x48 blocks, every picture line shown 4 times.  */
 
   /* 1. Initialize MultiColor Mode.  */
   tms9918aWriteReg (0, 0);    /* Multicolor mode, no external video.  */
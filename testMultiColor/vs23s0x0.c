@@ -25,6 +25,10 @@
  * SOFTWARE.
  *****************************************************************************/
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "vs23s0x0.h"
 #include "vs23s0x0-hal.h"
 #include "vs23s0x0-internal.h"
@@ -72,25 +76,324 @@ static const uint8_t vs23_ops_pal[2][5] = {
   },
 };
 
+/* Video timings in integer units, indexed by [m_pal][m_interlace], see
+   TIMING.  */
+
+struct video_timing_t {
+  uint16_t pllclks_per_line;
+  uint16_t colorclks_per_line;
+  uint16_t colorclks_line_half;
+  uint16_t protoline_length_words;
+  uint16_t protolines;
+  uint16_t total_lines;
+  uint16_t field1start;
+  uint16_t front_porch_lines;
+  uint16_t shortsync;
+  uint16_t shortsyncm;
+  uint16_t longsync;
+  uint16_t longsyncm;
+  uint16_t sync;
+  uint16_t burst;
+  uint16_t burstdur;
+  uint16_t blankend;
+  uint16_t frporch;
+  uint16_t line_ns;
+};
+
+static const struct video_timing_t vs23_timing[2][2] = {
+  { VIDEO_TIMING (NTSC, PROGRESSIVE), VIDEO_TIMING (NTSC, INTERLACE) },
+  { VIDEO_TIMING (PAL, PROGRESSIVE), VIDEO_TIMING (PAL, INTERLACE) },
+};
+
+/* Prebuilt protoline images.  A protoline is a sequence of runs of
+   one level, each run ends before word END of the line and the last
+   one at the end of the line.  See videoInit for what the lines are
+   used for.  */
+
+struct proto_run_t {
+  uint16_t end;
+  uint16_t level;
+};
+
+struct protoline_t {
+  struct proto_run_t run[PROTO_RUNS];
+};
+
+#define P_END(sys) (T_COLORCLKS_PER_LINE(sys) + 1)
+#define P_HALF(sys) T_COLORCLKS_LINE_HALF(sys)
+
+/// Sync, color burst and black picture area.
+#define P_PICTURE(sys) { {						\
+      { T_SYNC(sys), SYNC_LEVEL }, { T_BURST(sys), BLANK_LEVEL },	\
+      { T_BURST(sys) + T_BURSTDUR(sys), BURST_LEVEL },			\
+      { T_BLANKEND(sys), BLANK_LEVEL }, { T_FRPORCH(sys), BLACK_LEVEL },	\
+      { P_END(sys), BLANK_LEVEL } } }
+/// Like P_PICTURE, with a short sync in the middle of the line.
+#define P_PICTURE_SHORT(sys) { {					\
+      { T_SYNC(sys), SYNC_LEVEL }, { T_BURST(sys), BLANK_LEVEL },	\
+      { T_BURST(sys) + T_BURSTDUR(sys), BURST_LEVEL },			\
+      { T_BLANKEND(sys), BLANK_LEVEL }, { P_HALF(sys), BLACK_LEVEL },	\
+      { P_HALF(sys) + T_SHORTSYNCM(sys), SYNC_LEVEL },			\
+      { P_END(sys), BLANK_LEVEL } } }
+/// Picture line without color burst, setColorSpace adds it.
+#define P_PICTURE_NOBURST(sys) { {					\
+      { T_SYNC(sys), SYNC_LEVEL }, { T_BLANKEND(sys), BLANK_LEVEL },	\
+      { T_FRPORCH(sys), BLACK_LEVEL }, { P_END(sys), BLANK_LEVEL } } }
+/// VSYNC line with FIRST and SECOND long sync pulses at the beginning
+/// and in the middle.
+#define P_VSYNC(sys, first, second) { {				\
+      { first, SYNC_LEVEL }, { P_HALF(sys), BLANK_LEVEL },		\
+      { P_HALF(sys) + second, SYNC_LEVEL }, { P_END(sys), BLANK_LEVEL } } }
+/// VSYNC line with only a short sync at the beginning.
+#define P_VSYNC_LAST(sys) { {						\
+      { T_SHORTSYNC(sys), SYNC_LEVEL }, { P_END(sys), BLANK_LEVEL } } }
+
+#define PROTOLINES_INTERLACE_IMAGE(sys) {				\
+    P_PICTURE(sys), P_PICTURE_SHORT(sys), P_PICTURE(sys),		\
+    P_VSYNC(sys, T_SHORTSYNC(sys), T_SHORTSYNCM(sys)),			\
+    P_VSYNC(sys, T_LONGSYNC(sys), T_LONGSYNCM(sys)),			\
+    P_VSYNC(sys, T_LONGSYNC(sys), T_SHORTSYNCM(sys)),			\
+    P_VSYNC(sys, T_SHORTSYNC(sys), T_LONGSYNCM(sys)),			\
+    P_VSYNC_LAST(sys) }
+
+#define PROTOLINES_PROGRESSIVE_IMAGE(sys) {				\
+    P_PICTURE_NOBURST(sys),						\
+    P_VSYNC(sys, T_SHORTSYNC(sys), T_SHORTSYNCM(sys)),			\
+    P_VSYNC(sys, T_LONGSYNC(sys), T_LONGSYNCM(sys)),			\
+    P_VSYNC(sys, T_LONGSYNC(sys), T_SHORTSYNCM(sys)) }
+
+static const struct protoline_t protolines_ntsc_p[PROTOLINES_PROGRESSIVE] =
+  PROTOLINES_PROGRESSIVE_IMAGE (NTSC);
+static const struct protoline_t protolines_ntsc_i[PROTOLINES_INTERLACE] =
+  PROTOLINES_INTERLACE_IMAGE (NTSC);
+static const struct protoline_t protolines_pal_p[PROTOLINES_PROGRESSIVE] =
+  PROTOLINES_PROGRESSIVE_IMAGE (PAL);
+static const struct protoline_t protolines_pal_i[PROTOLINES_INTERLACE] =
+  PROTOLINES_INTERLACE_IMAGE (PAL);
+
+static const struct protoline_t *const vs23_protolines[2][2] = {
+  { protolines_ntsc_p, protolines_ntsc_i },
+  { protolines_pal_p, protolines_pal_i },
+};
+
 static const struct video_mode_t modes_ntsc[] = {
-  {256, 224,  9, 15, 5, 9},	// SNES
-  {256, 192, 24, 15, 5, 8},	// MSX, Spectrum, NDS XXX: has
-  {160, 200, 20, 15, 8, 8},	// Commodore/PCjr/CPC
+  {256, 224,  9, 15, 5, 9, 1, false},	// SNES
+  {256, 192, 24, 15, 5, 8, 1, false},	// MSX, Spectrum, NDS XXX: has
+  {160, 200, 20, 15, 8, 8, 1, false},	// Commodore/PCjr/CPC
+  // Line replicated modes, picture lines are shown on vrep scan lines.
+  {160, 100, 20, 15, 8, 8, 2, false},	// Commodore/PCjr/CPC, line doubled
+  {256,  48, 24, 15, 5, 8, 4, false},	// TMS9918 multicolor 4x4 blocks
+  // Interlace only, the fields show alternate picture lines.
+  {256, 480,  0, 14, 5, 4, 1, true},	// 32x60 8x8 characters
 };
 
 static const struct video_mode_t modes_pal[] = {
-  {256, 224, 32, 20,  6, 8},	// SNES
-  {256, 192, 42, 20,  6, 8},	// MSX, Spectrum, NDS
-  {160, 200, 41, 15, 10, 8},	// Commodore/PCjr/CPC
+  {256, 224, 32, 20,  6, 8, 1, false},	// SNES
+  {256, 192, 42, 20,  6, 8, 1, false},	// MSX, Spectrum, NDS
+  {160, 200, 41, 15, 10, 8, 1, false},	// Commodore/PCjr/CPC
+  // Line replicated modes, picture lines are shown on vrep scan lines.
+  {160, 100, 41, 15, 10, 8, 2, false},	// Commodore/PCjr/CPC, line doubled
+  {256,  48, 42, 20,  6, 8, 4, false},	// TMS9918 multicolor 4x4 blocks
+  // Interlace only, the fields show alternate picture lines.
+  {216, 568,  3,  7,  8, 2, 1, true},	// 27x71 8x8 characters
 };
 
 static bool m_vsync_enabled;
 static uint8_t m_gpio_state;
 static uint32_t m_pitch;  // Distance between piclines in bytes
 static uint32_t m_first_line_addr;
+static uint16_t m_draw_width;	// Size of the draw surface, for clipping
+static uint16_t m_draw_height;
 static uint16_t m_sync_line;
 static uint32_t m_line_adjust;
 
+/// Off-screen SRAM behind the frame buffer, blocks sorted by address.
+struct sram_block_t {
+  uint32_t addr;
+  uint32_t size;
+};
+static struct sram_block_t m_sram_block[MAX_SRAM_BLOCKS];
+static uint8_t m_sram_blocks;
+static uint32_t m_sram_start;
+
+/// Picture buffers, buffer 0 is the frame buffer set up by setMode.
+/// Further buffers are allocated from the off-screen SRAM.
+#define MAX_PICBUFS 4
+struct picbuf_t {
+  struct surface_t surf;
+  uint16_t scroll;		// Line shown at band offset 0
+};
+static struct picbuf_t m_picbuf[MAX_PICBUFS];
+static uint8_t m_picbufs;
+
+/// Bands of scan lines showing a picture buffer from line y (relative
+/// to the buffer scroll position) on, the first phase replicas of line
+/// y already shown above the band.
+#define MAX_BANDS 8
+struct band_t {
+  uint16_t first;
+  uint16_t count;
+  uint8_t buf;
+  uint8_t phase;
+  uint16_t y;
+};
+static struct band_t m_band[MAX_BANDS];
+static uint8_t m_bands;
+
+static struct mem_layout_t m_layout;
+static unsigned long m_ready_at;	// millis() when the display is synced
+static bool m_video_on;		// videoInit has built the sync for...
+static bool m_video_pal;	// ...this system
+static bool m_video_interlace;	// ...and scan type
+
+/// Channels, one bit per VS23 on the bus: m_displays show the
+/// picture, m_channels get the drawing and m_ic_mask is what the
+/// multi-IC register was last set to, 0 if that is not known.
+static uint8_t m_displays = 1;
+static uint8_t m_channels = 1;
+static uint8_t m_ic_mask;
+
+/// Beam predictor: the beam was at the start of line m_beam_line at
+/// micros() m_beam_us.  A frame (a field if interlaced) takes
+/// m_frame_us and m_frame_lines, m_frame_us is 0 until measured.
+static uint32_t m_beam_us;
+static uint16_t m_beam_line;
+static uint32_t m_beam_checked;
+static uint32_t m_frame_us;
+static uint16_t m_frame_lines;
+
+/// Frame pacing: m_frames counts passes of the beam over the sync
+/// line, the next one is due at micros() m_vsync_us if m_vsync_armed.
+static uint32_t m_frames;
+static uint32_t m_vsync_us;
+static bool m_vsync_armed;
+static uint32_t m_loop_frame;
+static bool m_loop_started;	// m_loop_frame is set for this mode
+static void (*m_frame_callback) (void);
+
+/// Deferred updates: m_defer_count queued calls from m_defer_head on,
+/// the last call of a group has its end flag set.  m_byte_ns is the
+/// SPI time per byte as measured from the calls run so far.
+struct defer_op_t {
+  void (*run) (uint32_t, uint32_t);
+  uint32_t a;
+  uint32_t b;
+  uint16_t bytes;		// SPI bytes the call sends, roughly
+  uint8_t channels;		// m_channels when it was queued
+  bool end;
+};
+static struct defer_op_t m_defer_op[MAX_DEFERRED];
+static uint8_t m_defer_head;
+static uint8_t m_defer_count;
+static bool m_defer_open;	// Between deferBegin and deferEnd
+static bool m_defer_running;
+static uint16_t m_defer_budget;	// Microseconds per blank, 0 for all
+static uint16_t m_byte_ns = DEFER_BYTE_NS;
+
+/// Fast clearScreen state: frame buffer lines with their bit set in
+/// m_clear_pending are still shown from the pre-filled m_clear_line
+/// while the block mover clears them from (m_clear_x, m_clear_y) on.
+static uint32_t m_clear_line;
+static uint16_t m_clear_lines;
+static uint8_t m_clear_pending[MAX_PICLINES / 8];
+static uint16_t m_clear_x;
+static uint16_t m_clear_y;
+
+/// Glyph cache: rendered glyphs of m_glyph_w x m_glyph_h pixels in
+/// slots of an off-screen atlas at m_glyph_atlas, m_glyph_cols to an
+/// atlas row.  The atlas has the pitch of the frame buffer so that a
+/// glyph is drawn with one block move.  Slots are found by key through
+/// hash chains and reused least recently drawn first.  The slots and
+/// the hash buckets are allocated by glyphCacheBegin, for as many
+/// slots as asked for and fit into the atlas.
+#define GLYPH_NONE 0xffff
+struct glyph_slot_t {
+  uint32_t key;			// glyph << 16 | fg << 8 | bg
+  uint32_t used;		// m_glyph_clock when last drawn, 0 if free
+  uint16_t next;		// Next slot in the same hash chain
+};
+static struct glyph_slot_t *m_glyph_slot;
+static uint16_t *m_glyph_bucket;
+static uint16_t m_glyph_slots;
+static uint32_t m_glyph_atlas;
+static uint16_t m_glyph_pitch;
+static uint16_t m_glyph_cols;
+static uint8_t m_glyph_w;
+static uint8_t m_glyph_h;
+static uint32_t m_glyph_clock;
+
+/// Geometry is drawn in runs of pixels: consecutive pixels of a line
+/// or an outline are collected into a horizontal or vertical run from
+/// (m_run_x0, m_run_y0) to (m_run_x1, m_run_y1), drawn as one span.
+/// drawArc keeps the pixels between the directions m_arc_s* and
+/// m_arc_e*, scaled by 1024, clockwise; m_arc_wide if that is more
+/// than half the circle.
+static int16_t m_run_x0, m_run_y0, m_run_x1, m_run_y1;
+static bool m_run_open;
+static uint8_t m_run_color;
+static int16_t m_arc_sx, m_arc_sy, m_arc_ex, m_arc_ey;
+static bool m_arc_wide;
+
+/// A span fillPolygon repeats on H lines from Y on; NEXT once it is
+/// found on the line after those.
+struct poly_block_t {
+  int16_t x0;
+  int16_t x1;
+  int16_t y;
+  uint16_t h;
+  bool next;
+};
+
+/// Dirty rectangle tracking: while m_dirty_on, drawing adds the area
+/// it draws to m_dirty, merged by the cost of repainting, see
+/// dirtyInsert.  The cost model is in nanoseconds: m_dirty_write_ns
+/// and m_dirty_move_ns are the overheads of a write transaction and of
+/// a block move, m_dirty_byte_ns and m_dirty_move_byte_ns the time of
+/// a byte written and moved.  m_dirty_blit if the application can
+/// repaint with block moves.
+static struct dirty_rect_t m_dirty[MAX_DIRTY_RECTS];
+static uint32_t m_dirty_cost[MAX_DIRTY_RECTS];
+static uint8_t m_dirty_count;
+static bool m_dirty_on;
+static bool m_dirty_blit;
+static bool m_dirty_timed;
+static uint32_t m_dirty_write_ns = DIRTY_WRITE_NS;
+static uint16_t m_dirty_byte_ns = DIRTY_BYTE_NS;
+static uint32_t m_dirty_move_ns = DIRTY_MOVE_NS;
+static uint16_t m_dirty_move_byte_ns = DIRTY_MOVE_BYTE_NS;
+
+static void clearTouch (uint32_t, uint32_t);
+static void moveBlockRaw (uint32_t, uint32_t, uint16_t, uint8_t, uint8_t,
+			  uint8_t);
+static bool deferred (void (*) (uint32_t, uint32_t), uint32_t, uint32_t,
+		      uint16_t);
+static struct defer_op_t *deferTail (void);
+static void runDeferred (uint32_t, bool);
+
+/* Drawing to SRAM bytes LO to HI may need the lazy clear first.  */
+
+static inline void
+touchRange (uint32_t lo, uint32_t hi)
+{
+  if (m_clear_lines)
+    clearTouch (lo, hi);
+}
+
+/* Drawing to the draw surface damages W x H pixels from (X, Y) on.  */
+
+static inline void
+damage (uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  if (m_dirty_on)
+    dirtyAdd (x, y, w, h);
+}
+
+static inline bool
+clearPending (uint16_t line)
+{
+  return m_clear_pending[line >> 3] & (1 << (line & 7));
+}
+
 static bool m_interlace;
 static bool m_pal;
 static bool m_lowpass;
@@ -141,60 +444,61 @@ static inline void startBlockMove (void)
 #define ROW_GB 1
 #define ROW_GR 8
 
-static uint8_t
-colorFromRgb (uint8_t r, uint8_t g, uint8_t b)
-{
-  uint8_t hue = (YYRGB(r, g, b) >> 4) & 0x0f;;
-
-  if (r >= b && b > g)
-    return (ROW_RB * 16 + hue);
-
-  if (r >= g && g > b)
-    return (ROW_RG * 16 + hue);
-
-  if (b >= r && r > g)
-    return (ROW_BR * 16 + hue);
-
-  if (b >= g && g > r)
-    return (ROW_BG * 16 + hue);
-
-  if (g >= b && b > r)
-    return (ROW_GB * 16 + hue);
-
-  if (g >= r && r > b)
-    return (ROW_GR * 16 + hue);
+/// Colour row of colorFromRgb by how r compares with g, r with b and
+/// g with b, see rgbOrder.  Orders that cannot occur are ROW_BW.
+static const uint8_t rgb_row[27] = {
+  // r < g
+  ROW_BG * 16, ROW_BG * 16, ROW_GB * 16,
+  ROW_BW * 16, ROW_BW * 16, ROW_G * 16,
+  ROW_BW * 16, ROW_BW * 16, ROW_GR * 16,
+  // r == g
+  ROW_B * 16, ROW_BW * 16, ROW_BW * 16,
+  ROW_BW * 16, ROW_BW * 16, ROW_BW * 16,
+  ROW_BW * 16, ROW_BW * 16, ROW_RG * 16,
+  // r > g
+  ROW_BR * 16, ROW_BW * 16, ROW_BW * 16,
+  ROW_RB * 16, ROW_BW * 16, ROW_BW * 16,
+  ROW_RB * 16, ROW_R * 16, ROW_RG * 16,
+};
 
-  if (r > b && r > g)
-    return (ROW_R * 16 + hue);
+/* 0 if A is less than B, 1 if equal, 2 if greater, without
+   branches.  */
 
-  if (b > r && b > g)
-    return (ROW_B * 16 + hue);
+static inline uint8_t
+rgbOrder (uint8_t a, uint8_t b)
+{
+  return (a >= b) + (a > b);
+}
 
-  if (g > r && g > b)
-    return (ROW_G * 16 + hue);
+static uint8_t
+colorFromRgb (uint8_t r, uint8_t g, uint8_t b)
+{
+  uint8_t hue = (YYRGB(r, g, b) >> 4) & 0x0f;
 
-  return (ROW_BW * 16 + hue);
+  return rgb_row[rgbOrder (r, g) * 9 + rgbOrder (r, b) * 3 + rgbOrder (g, b)]
+    + hue;
 }
 
+/* Write COUNT times the word DATA from word address WADDRESS on, in
+   one burst.  */
+
 static void
-SpiRamWriteWord (uint16_t waddress, uint16_t data)
+SpiRamFillWords (uint16_t waddress, uint16_t data, uint16_t count)
 {
   uint32_t address = (uint32_t) waddress << 1;
-  // address = address + (channel * ch_block);
 
   vs23Select();
   spi_transfer32 (WRITE_SRAM << 24 | (address & 0x00ffffff));
-  spi_transfer16 (data);
+  while (count--)
+    spi_transfer16 (data);
   vs23Deselect();
 }
 
 static void
 setBorder_i (uint8_t y, uint8_t uv, uint16_t dx, uint16_t width)
 {
-  uint32_t w = PROTOLINE_WORD_ADDRESS(0) + BLANKEND + dx;
-  for (int i = 0; i < width; i++) {
-    SpiRamWriteWord ((uint16_t)w++, (uv << 8) | (y + 0x66));
-  }
+  SpiRamFillWords (PROTOLINE_WORD_ADDRESS(0) + BLANKEND + dx,
+		   (uv << 8) | (y + 0x66), width);
 }
 
 /* Write 8b register.  */
@@ -207,6 +511,19 @@ SpiRamWriteByteRegister (uint16_t opcode, uint16_t data)
   vs23Deselect();
 }
 
+/* Send the following commands to the channels in MASK only.  The
+   multi-IC register enables the ICs whose bits are clear, all of them
+   listen to the register itself.  */
+
+static void
+selectIcs (uint8_t mask)
+{
+  if (mask == m_ic_mask || mask == 0)
+    return;
+  SpiRamWriteByteRegister (WRITE_MULTIIC, ~mask & ALL_CHANNELS);
+  m_ic_mask = mask;
+}
+
 /* Write 32b register.  */
 
 static void
@@ -221,14 +538,40 @@ SpiRamWriteProgram (uint16_t opcode, uint16_t data1, uint16_t data2)
 static void
 SpiRamWriteByte (uint32_t address, uint8_t data)
 {
-  // address = address + (channel * ch_block);
-
   vs23Select();
   spi_transfer32 (WRITE_SRAM << 24 | (address & 0x00ffffff));
   spi_transfer (data);
   vs23Deselect();
 }
 
+/* Start an auto-increment write burst at ADDRESS, the data bytes are
+   sent with spi_transfer and the burst ends with SpiRamWriteEnd.  */
+
+static inline void
+SpiRamWriteBegin (uint32_t address)
+{
+  vs23Select();
+  spi_transfer32 (WRITE_SRAM << 24 | (address & 0x00ffffff));
+}
+
+static inline void
+SpiRamWriteEnd (void)
+{
+  vs23Deselect();
+}
+
+/* Send one picture line index entry inside a write burst.  */
+
+static inline void
+picIndexData (uint32_t byteAddress, uint16_t protoAddress)
+{
+  // Byteaddress LSB, bits to 0, proto to given value
+  spi_transfer ((uint8_t)(((byteAddress << 7) & 0x80) | (protoAddress & 0xf)));
+  // This is wordaddress
+  spi_transfer ((uint8_t)(byteAddress >> 1));
+  spi_transfer ((uint8_t)(byteAddress >> 9));
+}
+
 static void
 SpiRamWriteBMCtrl (uint16_t opcode, uint16_t data1,
 		   uint16_t data2, uint16_t data3)
@@ -278,12 +621,17 @@ static uint32_t piclineByteAddress(int line)
 uint16_t
 SpiRamReadRegister (uint16_t opcode)
 {
+  uint8_t mask = m_ic_mask;
   uint16_t result;
 
+  // Several ICs answering at once garble the data, ask the first.
+  if (mask & (mask - 1))
+    selectIcs (mask & -mask);
   vs23Select();
   spi_transfer(opcode);
   result = spi_transfer16 (0);
   vs23Deselect();
+  selectIcs (mask);
 
   return result;
 }
@@ -298,6 +646,12 @@ SpiRamWriteRegister (uint16_t opcode, uint16_t data)
   vs23Deselect();
 }
 
+static void
+setLineIndexOp (uint32_t line, uint32_t wordAddress)
+{
+  SetLineIndex (line, wordAddress);
+}
+
 /* Set proto type picture line indexes.  */
 
 void
@@ -305,6 +659,8 @@ SetLineIndex (uint16_t line, uint16_t wordAddress)
 {
   uint32_t indexAddr = INDEX_START_BYTES + line * 3;
 
+  if (deferred (setLineIndexOp, line, wordAddress, 15))
+    return;
   SpiRamWriteByte(indexAddr++, 0); // Byteaddress and bits to 0,
   // proto to 0
   SpiRamWriteByte(indexAddr++, wordAddress); // Actually it's
@@ -312,18 +668,32 @@ SetLineIndex (uint16_t line, uint16_t wordAddress)
   SpiRamWriteByte(indexAddr, wordAddress >> 8);
 }
 
+static void
+setColorSpaceOp (uint32_t palette, uint32_t unused)
+{
+  (void) unused;
+  setColorSpace (palette);
+}
+
 void
 setColorSpace (uint8_t palette)
 {
+  if (deferred (setColorSpaceOp, palette, 0, 9 + 2 * BURSTDUR))
+    return;
   // 8. Set microcode program for picture lines
   // Use HROP1/HROP2/OP4/OP4 for 2 PLL clocks per pixel modes
   const uint8_t *ops = m_pal ? vs23_ops_pal[palette] : vs23_ops_ntsc[palette];
   SpiRamWriteProgram (PROGRAM,
 		      (ops[3] << 8) | ops[2], (ops[1] << 8) | ops[0]);
   // Set color burst
-  uint32_t w = PROTOLINE_WORD_ADDRESS(0) + BURST;
-  for (int i = 0; i < BURSTDUR; i++)
-    SpiRamWriteWord ((uint16_t)w++, BURST_LEVEL | (ops[4]) << 8);
+  SpiRamFillWords (PROTOLINE_WORD_ADDRESS(0) + BURST,
+		   BURST_LEVEL | (ops[4]) << 8, BURSTDUR);
+}
+
+static void
+setPicIndexOp (uint32_t byteAddress, uint32_t line_proto)
+{
+  SetPicIndex (line_proto >> 4, byteAddress, line_proto & 0xf);
 }
 
 // Set picture type line indexes
@@ -332,622 +702,3181 @@ SetPicIndex (uint16_t line,
 	     uint32_t byteAddress,
 	     uint16_t protoAddress)
 {
-  uint32_t indexAddr = INDEX_START_BYTES + line * 3;
-
-  // Byteaddress LSB, bits to 0, proto to given value
-  SpiRamWriteByte (indexAddr++,
-		   (uint16_t)((byteAddress << 7) & 0x80)
-		   | (protoAddress & 0xf));
-  // This is wordaddress
-  SpiRamWriteByte (indexAddr++, (uint16_t)(byteAddress >> 1));
-  SpiRamWriteByte (indexAddr, (uint16_t)(byteAddress >> 9));
+  if (deferred (setPicIndexOp, byteAddress,
+		((uint32_t) line << 4) | (protoAddress & 0xf), 7))
+    return;
+  SpiRamWriteBegin (INDEX_START_BYTES + line * 3);
+  picIndexData (byteAddress, protoAddress);
+  SpiRamWriteEnd ();
 }
 
-// Set picture pixel to a RGB value.
-void
-setPixelRgb (uint16_t xpos, uint16_t ypos, uint8_t r, uint8_t g,
-	     uint8_t b)
-{
-  uint8_t pixdata = colorFromRgb(r, g, b);
-
-  uint32_t byteaddress;
+/* SPI bytes of rewriting the line index of the whole picture.  */
 
-  byteaddress = pixelAddr(xpos, ypos);
-  SpiRamWriteByte(byteaddress, pixdata);
+static inline uint16_t
+indexBytes (void)
+{
+  return (m_interlace ? 2 : 1) * (4 + 3 * SCANLINES);
 }
 
-void
-setPixelYuv (uint16_t xpos, uint16_t ypos, uint8_t color)
+static void
+mapPicLinesOp (uint32_t first_lines, uint32_t flip)
 {
-  uint32_t byteaddress = pixelAddr (xpos, ypos);
-  SpiRamWriteByte(byteaddress, color);
+  mapPicLines (first_lines >> 16, first_lines & 0xffff, flip);
 }
 
+/* Point the picture scan lines at LINES lines of the selected picture
+   buffer starting with line FIRST.  The lines are stretched over the
+   whole picture area, hence a mode with vrep N shows each line N times,
+   less lines zoom in vertically and FLIP turns the picture upside down.
+   Only the line index is rewritten, one burst per field; binding or
+   scrolling a picture buffer overrides the mapping again.  */
+
 void
-setBorder(uint8_t y, uint8_t uv)
+mapPicLines (uint16_t first, uint16_t lines, bool flip)
 {
-  setBorder_i (y, uv, 0, FRPORCH - BLANKEND);
+  uint16_t field, s, step = PICFIELDS;
+
+  if (lines == 0)
+    return;
+  if (deferred (mapPicLinesOp, ((uint32_t) first << 16) | lines, flip,
+		indexBytes ()))
+    return;
+
+  for (field = 0; field < (m_interlace ? 2 : 1); field++)
+    {
+      SpiRamWriteBegin (INDEX_START_BYTES
+			+ (STARTLINE + field * FIELD1START) * 3);
+      for (s = 0; s < SCANLINES; s++)
+	{
+	  uint16_t j = s * step + (step == 2 ? field : 0);
+	  uint16_t n = (uint32_t) j * lines / PICSCANS;
+	  picIndexData (piclineByteAddress (first + (flip ? lines - 1 - n : n)),
+			0);
+	}
+      SpiRamWriteEnd ();
+    }
 }
 
-// ---------------------------------------------------------------------------
-// Equivalent to Config
-// Initialize the VS32S0x0 chip
-//
-void
-videoInit (uint8_t channel)
-{
-  uint16_t i, j;
-  uint32_t w;
-
-#if 0
-  uint16_t linelen = PLLCLKS_PER_LINE;
-  Serial.print("Linelen: %d PLL clks"); Serial.println (linelen, DEC);
-  Serial.print("Picture line area is %d x %d\n"); Serial.println (PICX, DEC); Serial.println (PICY, DEC);
-  //  Serial.printf("Upper left corner is point (0,0) and lower right corner (%d,%d)\n",
-  //	 PICX - 1, PICY - 1);
-  Serial.print("Memory space available for picture bytes %ld\n");
-  Serial.println (131072 - PICLINE_START, DEC);
-  Serial.print("Free bytes %ld\n");
-  Serial.println (131072 - PICLINE_START - (PICX + BEXTRA) * PICY * PICBITS / 8, DEC);
-  //Serial.printf("Picture line %d bytes\n", PICLINE_LENGTH_BYTES + BEXTRA);
-  //Serial.printf("Picture length, %d color cycles\n", PICLENGTH);
-  //Serial.printf("Picture pixel bits %d\n", PICBITS);
-  //Serial.printf("Start pixel %x\n", (STARTPIX - 1));
-  //Serial.printf("End pixel %x\n", (ENDPIX - 1));
-  //Serial.printf("Index start address %x\n", INDEX_START_BYTES);
-  //Serial.printf("Picture line 0 address %lx\n", piclineByteAddress(0));
-  //Serial.printf("Last line %d\n", PICLINE_MAX);
-#endif
+/* Write the line index of N scan lines of band B from its scan line
+   K on.  Buffer lines wrap around, so a band can show any vertical
+   offset of its buffer.  Frame buffer lines waiting for the lazy clear
+   keep showing the pre-filled line.  If the fields show alternate
+   lines, picture scan line J is scan line J / 2 of field J % 2.  */
 
-  // Disable video generation
-  SpiRamWriteRegister(VDCTRL2, 0);
+static void
+writeBandLines (const struct band_t *b, uint16_t k, uint16_t n)
+{
+  const struct surface_t *pb = &m_picbuf[b->buf].surf;
+  uint16_t scroll = m_picbuf[b->buf].scroll;
+  uint16_t field, step = PICFIELDS, end = b->first + k + n;
 
-  // 1. Select the first VS23 for following commands in case there
-  // are several VS23 ICs connected to same SPI bus.
-  SpiRamWriteByteRegister(WRITE_MULTIIC, 0xe);
-  // 2. Set SPI memory address autoincrement
-  SpiRamWriteByteRegister(WRITE_STATUS, 0x40);
+  for (field = 0; field < (m_interlace ? 2 : 1); field++)
+    {
+      uint16_t j = b->first + k;
+
+      if (step == 2 && (j & 1) != field)
+	j++;
+      if (j >= end)
+	continue;
+      SpiRamWriteBegin (INDEX_START_BYTES
+			+ (STARTLINE + j / step + field * FIELD1START) * 3);
+      for (; j < end; j += step)
+	{
+	  uint16_t line
+	    = (scroll + b->y + (j - b->first + b->phase) / LINEREP)
+	    % pb->height;
+
+	  if (b->buf == 0 && m_clear_lines && clearPending (line))
+	    picIndexData (m_clear_line, 0);
+	  else
+	    picIndexData (pb->base + (uint32_t) pb->pitch * line, 0);
+	}
+      SpiRamWriteEnd ();
+    }
+}
 
-  // 4. Write picture start and end
-  SpiRamWriteRegister(PICSTART, (STARTPIX - 1));
-  SpiRamWriteRegister(PICEND, (ENDPIX - 1));
+static inline void
+writeBandIndex (const struct band_t *b)
+{
+  writeBandLines (b, 0, b->count);
+}
 
-  // 5. Enable PLL clock
-  SpiRamWriteRegister(VDCTRL1,
-		      (VDCTRL1_PLL_ENABLE) | (VDCTRL1_SELECT_PLL_CLOCK));
-  // 6. Clear the video memory
-  for (w = 0; w < 65536; w++)
-    SpiRamWriteWord((uint16_t)w, 0x0000);	// Clear memory
+/* Write the line index of all bands showing picture buffer BUF.  */
 
-  // 7. Set length of one complete line (unit: PLL clocks)
-  SpiRamWriteRegister(LINELEN, (PLLCLKS_PER_LINE));
-  // 9. Define where Line Indexes are stored in memory
-  SpiRamWriteRegister(INDEXSTART, INDEX_START_LONGWORDS);
+static void
+writeBufIndex (uint8_t buf)
+{
+  uint8_t i;
 
-  // 10. Enable the PAL Y lowpass filter, not used in NTSC
-  SpiRamWriteBMCtrl(BLOCKMVC1,0,0,BLOCKMVC1_PYF);
-  // 11. Set all line indexes to point to protoline 0 (which by
-  // definition is in the beginning of the SRAM)
-  for (i = 0; i < TOTAL_LINES; i++)
-    SetLineIndex(i, PROTOLINE_WORD_ADDRESS(0));
+  for (i = 0; i < m_bands; i++)
+    if (m_band[i].buf == buf)
+      writeBandIndex (&m_band[i]);
+}
 
-  // At this time, the chip would continuously output the proto line 0.
-  // This protoline will become our most "normal" horizontal line.
-  // For TV-Out, fill the line with black level, and insert a few
-  // pixels of sync level (0) and color burst to the beginning.
-  // Note that the chip hardware adds black level to all nonproto
-  // areas so protolines and normal picture have different meaning for
-  // the same Y value.
-  // In protolines, Y=0 is at sync level and in normal picture Y=0 is at
-  // black level (offset +102).
+static void
+writeBufIndexOp (uint32_t buf, uint32_t unused ATTRIBUTE_UNUSED)
+{
+  writeBufIndex (buf);
+}
 
-  // In protolines, each pixel is 8 PLLCLKs, which in TV-out modes
-  // means one color subcarrier cycle.  Each pixel has 16 bits (one
-  // word):
-  // VVVVUUUUYYYYYYYY.
+/* Write the scan lines that show lines LO to HI of picture buffer
+   BUF, in all bands.  */
 
-  if (m_interlace) {
-    uint16_t wi;
-    // Construct protoline 0 and 1. Protoline 0 is used for most of the
-    // picture.  Protoline 1 has a similar first half than 0, but the
-    // end has a short sync pulse.  This is used for line 623.
-    // Protoline 2 has a normal sync and color burst and nothing else.
-    // It is used between vertical sync lines and visible lines, but is
-    // not mandatory always.
-    for (j = 0; j <= 2; j++)
+static void
+writeBufLines (uint8_t buf, uint16_t lo, uint16_t hi)
+{
+  const struct surface_t *pb = &m_picbuf[buf].surf;
+  uint16_t line;
+  uint8_t i;
+
+  for (line = lo; line <= hi; line++)
+    for (i = 0; i < m_bands; i++)
       {
-	wi = PROTOLINE_WORD_ADDRESS(j);
-	// Set all to blank level.
-	for (i = 0; i <= COLORCLKS_PER_LINE; i++)
+	const struct band_t *b = &m_band[i];
+	uint16_t rel;
+
+	if (b->buf != buf)
+	  continue;
+	rel = (line + 2 * pb->height - m_picbuf[buf].scroll
+	       - b->y % pb->height) % pb->height;
+	for (; rel * LINEREP < b->count + b->phase; rel += pb->height)
 	  {
-	    SpiRamWriteWord(wi++, BLANK_LEVEL);
+	    uint16_t k = rel * LINEREP, n = LINEREP;
+
+	    // Scan lines K to K + N - 1 of the band, less the phase.
+	    if (k < b->phase)
+	      n -= b->phase - k;
+	    else
+	      k -= b->phase;
+	    if (k + n > b->count)
+	      n = b->count - k;
+	    writeBandLines (b, k, n);
 	  }
-	// Set the color level to black
-	wi = PROTOLINE_WORD_ADDRESS(j) + BLANKEND;
-	for (i = BLANKEND; i < FRPORCH; i++)
-	  {
-	    SpiRamWriteWord(wi++, BLACK_LEVEL);
-	  }
-	// Set HSYNC
-	wi = PROTOLINE_WORD_ADDRESS(j);
-	for (i = 0; i < SYNC; i++)
-	  SpiRamWriteWord(wi++, SYNC_LEVEL);
-	// Set color burst
-	wi = PROTOLINE_WORD_ADDRESS(j) + BURST;
-	for (i = 0; i < BURSTDUR; i++)
-	  SpiRamWriteWord(wi++, BURST_LEVEL);
       }
+}
 
-    // Add to the second half of protoline 1 a short sync
-    wi = PROTOLINE_WORD_ADDRESS(1) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < SHORTSYNCM; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // middle of line
-    for (i = COLORCLKS_LINE_HALF + SHORTSYNCM; i < COLORCLKS_PER_LINE; i++)
-      {
-	SpiRamWriteWord(wi++, BLANK_LEVEL);	// To the end of the
-	// line to blank level
-      }
+static void
+writeBufLinesOp (uint32_t lo, uint32_t hi)
+{
+  writeBufLines (0, lo, hi);
+}
 
-    // Now let's construct protoline 3, this will become our short+short
-    // VSYNC line
-    wi = PROTOLINE_WORD_ADDRESS(3);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++)
-      {
-	SpiRamWriteWord(wi++, BLANK_LEVEL);
-      }
-    wi = PROTOLINE_WORD_ADDRESS(3);
-    for (i = 0; i < SHORTSYNC; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // beginning of line
-    wi = PROTOLINE_WORD_ADDRESS(3) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < SHORTSYNCM; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // middle of line
-
-    // Now let's construct protoline 4, this will become our long+long
-    // VSYNC line
-    wi = PROTOLINE_WORD_ADDRESS(4);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord(wi++, BLANK_LEVEL);
-    }
-    wi = PROTOLINE_WORD_ADDRESS(4);
-    for (i = 0; i < LONGSYNC; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Long sync at the
-    // beginning of line
-    wi = PROTOLINE_WORD_ADDRESS(4) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < LONGSYNCM; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Long sync at the
-    // middle of line
-
-    // Now let's construct protoline 5, this will become our long+short
-    // VSYNC line
-    wi = PROTOLINE_WORD_ADDRESS(5);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord(wi++, BLANK_LEVEL);
-    }
-    wi = PROTOLINE_WORD_ADDRESS(5);
-    for (i = 0; i < LONGSYNC; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // beginning of line
-    wi = PROTOLINE_WORD_ADDRESS(5) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < SHORTSYNCM; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Long sync at the
-    // middle of line
-
-    // And yet a short+long sync line, protoline 6
-    wi = PROTOLINE_WORD_ADDRESS(6);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord(wi++, BLANK_LEVEL);
-    }
-    wi = PROTOLINE_WORD_ADDRESS(6);
-    for (i = 0; i < SHORTSYNC; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // beginning of line
-    wi = PROTOLINE_WORD_ADDRESS(6) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < LONGSYNCM; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Long sync at the
-    // middle of line
-
-    // Just short sync line, the last one, protoline 7
-    wi = PROTOLINE_WORD_ADDRESS(7);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord(wi++, BLANK_LEVEL);
-    }
-    wi = PROTOLINE_WORD_ADDRESS(7);
-    for (i = 0; i < SHORTSYNC; i++)
-      SpiRamWriteWord(wi++, SYNC_LEVEL);	// Short sync at the
-    // beginning of line
+static void
+bindIndexOp (uint32_t first_count, uint32_t buf_y)
+{
+  struct band_t b;
+
+  b.first = first_count >> 16;
+  b.count = first_count & 0xffff;
+  b.buf = buf_y >> 16;
+  b.phase = 0;
+  b.y = buf_y & 0xffff;
+  writeBandIndex (&b);
+}
 
-  } else {	// interlace
+/* Create a picture buffer of LINES lines, PITCH bytes apart (0 uses
+   the frame buffer pitch).  Returns the buffer number or -1 if the
+   SRAM is exhausted.  */
 
-    // Protolines for progressive NTSC, here is not created a
-    // protoline corresponding to interlace protoline 2.  Construct
-    // protoline 0
-    w = PROTOLINE_WORD_ADDRESS(0);	// Could be w=0 because proto 0 always
-    // starts at address 0
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord((uint16_t)w++, BLANK_LEVEL);
-    }
-
-    // Set the color level to black
-    setBorder(0, 0);
-
-    // Set HSYNC
-    w = PROTOLINE_WORD_ADDRESS(0);
-    for (i = 0; i < SYNC; i++)
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    // Makes a black&white picture
-    // for (i=0; i<BURSTDUR; i++) SpiRamWriteWord(w++,BLANK_LEVEL);
-
-    // Now let's construct protoline 1, this will become our short+short
-    // VSYNC line
-    w = PROTOLINE_WORD_ADDRESS(1);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord((uint16_t)w++, BLANK_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(1);
-    for (i = 0; i < SHORTSYNC; i++) {
-      // Short sync at the beginning of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(1) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < SHORTSYNCM; i++) {
-      // Short sync at the middle of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-
-    // Now let's construct protoline 2, this will become our long+long
-    // VSYNC line
-    w = PROTOLINE_WORD_ADDRESS(2);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord((uint16_t)w++, BLANK_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(2);
-    for (i = 0; i < LONGSYNC; i++) {
-      // Long sync at the beginning of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(2) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < LONGSYNCM; i++) {
-      // Long sync at the middle of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-
-    // Now let's construct protoline 3, this will become our long+short
-    // VSYNC line
-    w = PROTOLINE_WORD_ADDRESS(3);
-    for (i = 0; i <= COLORCLKS_PER_LINE; i++) {
-      SpiRamWriteWord((uint16_t)w++, BLANK_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(3);
-    for (i = 0; i < LONGSYNC; i++) {
-      // Short sync at the beginning of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-    w = PROTOLINE_WORD_ADDRESS(3) + COLORCLKS_LINE_HALF;
-    for (i = 0; i < SHORTSYNCM; i++) {
-      // Long sync at the middle of line
-      SpiRamWriteWord((uint16_t)w++, SYNC_LEVEL);
-    }
-  }
+int8_t
+createPicBuffer (uint16_t pitch, uint16_t lines)
+{
+  struct picbuf_t *pb = &m_picbuf[m_picbufs];
 
-  setColorSpace(1);
+  if (pitch == 0)
+    pitch = m_picbuf[0].surf.pitch;
+  if (m_picbufs == MAX_PICBUFS
+      || !surfaceCreate (&pb->surf, XPIXELS, lines, pitch))
+    return -1;
 
-  // 12. Now set first eight lines of frame to point to NTSC sync lines
-  // Here the frame starts, lines 1 and 2
-  if (m_interlace) {
-    if (m_pal) {
-      for (i=0; i<2; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
-      }
-      // Line 3
-      SetLineIndex(2, PROTOLINE_WORD_ADDRESS(5));
-      // Lines 4 and 5
-      for (i=3; i<5; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      // At this point, lines 0 to 4 are VSYNC lines and all other lines are proto0.
+  pb->scroll = 0;
+  return m_picbufs++;
+}
 
-      // Another batch of VSYNC lines is made between the two fields of interlaced PAL picture.
-      // The lines start from 310.
-      for (i=FIELD1START; i<FIELD1START+2; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      SetLineIndex(FIELD1START+2, PROTOLINE_WORD_ADDRESS(6));
-      for (i=FIELD1START+3; i<FIELD1START+5; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
-      }
-      for (i=FIELD1START+5; i<FIELD1START+7; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      SetLineIndex(FIELD1START+7, PROTOLINE_WORD_ADDRESS(7));
+/* Show picture buffer BUF, starting Y lines below its scroll
+   position, on the COUNT scan lines of the picture area from scan line
+   FIRST on.  Bands covered by the new one are trimmed or dropped, this
+   way a band can be page flipped between buffers by binding it
+   again.  If the fields show alternate lines, the scan lines of both
+   count together, in frame order.  Between deferBegin and deferEnd
+   the line index follows in the vertical blank.  */
 
-      // Set empty lines with sync and color burst to beginning of both frames.
-      for (i=5; i<FRONT_PORCH_LINES; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
-      for (i=FIELD1START+8; i<FIELD1START+FRONT_PORCH_LINES+2; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
+/* Make band B start at scan line FIRST, further down, keeping the
+   lines it shows there.  */
 
-      // These are the three last lines of the frame, lines 623-625
-      SetLineIndex(TOTAL_LINES-1-3, PROTOLINE_WORD_ADDRESS(1));
-      for (i=TOTAL_LINES-1-2; i<=TOTAL_LINES-1; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-    } else {
-      for (i = 0; i < 3; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      // Lines 4 to 6
-      for (i = 3; i < 6; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
-      }
-      // Lines 7 to 9
-      for (i = 6; i < 9; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      // At this point, lines 0 to 8 are VSYNC lines and all other lines are
-      // proto0.
+static void
+bandSkipTo (struct band_t *b, uint16_t first)
+{
+  uint16_t skip = first - b->first + b->phase;
 
-      // Another batch of VSYNC lines is made between the two fields of
-      // interlaced NTSC picture.
-      // The lines start from 261.
-      SetLineIndex(FIELD1START, PROTOLINE_WORD_ADDRESS(1));
-      for (i = FIELD1START + 1; i < FIELD1START + 3; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      SetLineIndex(FIELD1START + 3, PROTOLINE_WORD_ADDRESS(6));
-      for (i = FIELD1START + 4; i < FIELD1START + 6; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
-      }
-      SetLineIndex(FIELD1START + 6, PROTOLINE_WORD_ADDRESS(5));
-      for (i = FIELD1START + 7; i < FIELD1START + 9; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
-      }
-      SetLineIndex(FIELD1START + 9, PROTOLINE_WORD_ADDRESS(7));
+  b->y += skip / LINEREP;
+  b->phase = skip % LINEREP;
+  b->count -= first - b->first;
+  b->first = first;
+}
 
-      // Set empty lines with sync and color burst to beginning of both
-      // frames.
-      for (i = 9; i < FRONT_PORCH_LINES; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
-      for (i = FIELD1START + 10; i < FIELD1START + FRONT_PORCH_LINES; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
+bool
+bindPicBuffer (uint16_t first, uint16_t count, uint8_t buf, uint16_t y)
+{
+  uint16_t end = first + count;
+  uint8_t i = 0, bands = m_bands + 1;
+
+  if (buf >= m_picbufs || count == 0 || end > PICSCANS)
+    return false;
+
+  // Count the bands first, the table stays as it is if they do not fit.
+  for (i = 0; i < m_bands; i++)
+    {
+      const struct band_t *b = &m_band[i];
+      uint16_t b_end = b->first + b->count;
+
+      if (b->first < first && b_end > end)
+	bands++;
+      else if (b->first >= first && b_end <= end)
+	bands--;
     }
-  } else {	// interlace
-    if (m_pal) {
-      // For progressive PAL case, this is quite a minimum case.
-      // Here the frame starts, lines 1 and 2
-      for (i=0; i<2; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
-      // Line 3
-      SetLineIndex(2, PROTOLINE_WORD_ADDRESS(3));
-      // Lines 4 and 5
-      for (i=3; i<5; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
-      }
-      // These are three last lines of the frame, lines 310-312
-      for (i=TOTAL_LINES-3; i<TOTAL_LINES; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
-      }
-    } else {
-      // For progressive NTSC case, this is quite a minimum case.
-      // Here the frame starts, lines 1 to 3
-      for (i = 0; i < 3; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
-      }
-      // Lines 4 to 6
-      for (i = 3; i < 6; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
-      }
-      // Lines 7 to 9
-      for (i = 6; i < 9; i++) {
-	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
+  if (bands > MAX_BANDS)
+    return false;
+
+  i = 0;
+  while (i < m_bands)
+    {
+      struct band_t *b = &m_band[i];
+      uint16_t b_end = b->first + b->count;
+
+      if (b_end <= first || b->first >= end)
+	{
+	  i++;
+	  continue;
+	}
+      if (b->first < first && b_end > end)
+	{
+	  // Split, the tail continues below the new band.
+	  m_band[m_bands] = *b;
+	  bandSkipTo (&m_band[m_bands++], end);
+	}
+      if (b->first < first)
+	b->count = first - b->first;
+      else if (b_end > end)
+	bandSkipTo (b, end);
+      else
+	{
+	  *b = m_band[--m_bands];
+	  continue;
+	}
+      i++;
+    }
+
+  m_band[m_bands].first = first;
+  m_band[m_bands].count = count;
+  m_band[m_bands].buf = buf;
+  m_band[m_bands].phase = 0;
+  m_band[m_bands].y = y;
+  if (!deferred (bindIndexOp, (uint32_t) first << 16 | count,
+		 (uint32_t) buf << 16 | y, indexBytes ()))
+    writeBandIndex (&m_band[m_bands]);
+  m_bands++;
+  return true;
+}
+
+static void
+scrollPicBufferOp (uint32_t buf, uint32_t y)
+{
+  scrollPicBuffer (buf, y);
+}
+
+/* Scroll buffer BUF: the bands showing it count their lines from
+   buffer line Y from now on.  */
+
+void
+scrollPicBuffer (uint8_t buf, uint16_t y)
+{
+  if (buf >= m_picbufs)
+    return;
+  if (deferred (scrollPicBufferOp, buf, y, indexBytes ()))
+    return;
+
+  m_picbuf[buf].scroll = y % m_picbuf[buf].surf.height;
+  writeBufIndex (buf);
+}
+
+/* Direct the drawing functions to picture buffer BUF.  */
+
+void
+selectPicBuffer (uint8_t buf)
+{
+  if (buf < m_picbufs)
+    setDrawSurface (&m_picbuf[buf].surf);
+}
+
+/* Allocate SIZE bytes of the SRAM not used by the frame buffer, first
+   fit.  Returns the byte address or 0 if there is no room; 0 is never
+   valid as the protolines start there.  All blocks are released when
+   the mode is set.  */
+
+uint32_t
+sramAlloc (uint32_t size)
+{
+  uint32_t addr = m_sram_start;
+  uint8_t i;
+
+  size = (size + 1) & ~1UL;
+  if (size == 0 || m_sram_blocks == MAX_SRAM_BLOCKS)
+    return 0;
+
+  for (i = 0; i <= m_sram_blocks; i++)
+    {
+      uint32_t end = (i < m_sram_blocks) ? m_sram_block[i].addr : SRAM_SIZE;
+
+      if (end - addr >= size)
+	{
+	  uint8_t j;
+
+	  for (j = m_sram_blocks; j > i; j--)
+	    m_sram_block[j] = m_sram_block[j - 1];
+	  m_sram_block[i].addr = addr;
+	  m_sram_block[i].size = size;
+	  m_sram_blocks++;
+	  return addr;
+	}
+      if (i < m_sram_blocks)
+	addr = m_sram_block[i].addr + m_sram_block[i].size;
+    }
+
+  return 0;
+}
+
+void
+sramFree (uint32_t addr)
+{
+  uint8_t i;
+
+  for (i = 0; i < m_sram_blocks; i++)
+    if (m_sram_block[i].addr == addr)
+      {
+	for (m_sram_blocks--; i < m_sram_blocks; i++)
+	  m_sram_block[i] = m_sram_block[i + 1];
+	return;
       }
+}
+
+uint32_t
+sramFreeBytes (void)
+{
+  uint32_t used = 0;
+  uint8_t i;
+
+  for (i = 0; i < m_sram_blocks; i++)
+    used += m_sram_block[i].size;
+  return SRAM_SIZE - m_sram_start - used;
+}
+
+/* Write N bytes from DATA to ADDRESS in the SRAM of CHANNEL, in one
+   burst.  The SRAM of a channel that is not a display is all free
+   for the application; see setDisplays.  */
+
+void
+sramWrite (uint8_t channel, uint32_t address, const uint8_t *data,
+	   uint16_t n)
+{
+  selectIcs (1 << channel);
+  SpiRamWriteBegin (address);
+  while (n--)
+    spi_transfer (*data++);
+  SpiRamWriteEnd ();
+  selectIcs (m_channels);
+}
+
+void
+sramRead (uint8_t channel, uint32_t address, uint8_t *data, uint16_t n)
+{
+  selectIcs (1 << channel);
+  vs23Select();
+  spi_transfer32 ((uint32_t) READ_SRAM << 24 | (address & 0x00ffffff));
+  while (n--)
+    *data++ = spi_transfer (0);
+  vs23Deselect();
+  selectIcs (m_channels);
+}
+
+/* Copy N bytes from SRC in the SRAM of channel FROM to DST in the
+   channels in the mask TO, through the MCU as the block mover cannot
+   reach across ICs.  All of TO are written at once.  */
+
+void
+sramCopy (uint8_t from, uint32_t src, uint8_t to, uint32_t dst, uint32_t n)
+{
+  uint8_t buf[SRAM_COPY_CHUNK];
+
+  while (n)
+    {
+      uint16_t k = n < SRAM_COPY_CHUNK ? n : SRAM_COPY_CHUNK;
+      uint16_t i;
+
+      sramRead (from, src, buf, k);
+      selectIcs (to);
+      SpiRamWriteBegin (dst);
+      for (i = 0; i < k; i++)
+	spi_transfer (buf[i]);
+      SpiRamWriteEnd ();
+      src += k;
+      dst += k;
+      n -= k;
+    }
+  selectIcs (m_channels);
+}
+
+/* Create a WIDTH x HEIGHT surface in off-screen SRAM, lines PITCH
+   bytes apart (0 packs them).  */
+
+bool
+surfaceCreate (struct surface_t *s, uint16_t width, uint16_t height,
+	       uint16_t pitch)
+{
+  if (pitch == 0)
+    pitch = width;
+  s->base = sramAlloc ((uint32_t) pitch * height);
+  s->pitch = pitch;
+  s->width = width;
+  s->height = height;
+  return s->base != 0;
+}
+
+void
+surfaceDestroy (struct surface_t *s)
+{
+  sramFree (s->base);
+  s->base = 0;
+}
+
+/* Direct setPixel*, MoveBlock, blitRect and fillRectangle to surface
+   S, NULL is the frame buffer.  */
+
+void
+setDrawSurface (const struct surface_t *s)
+{
+  if (s == NULL)
+    s = &m_picbuf[0].surf;
+  m_first_line_addr = s->base;
+  m_pitch = s->pitch;
+  m_draw_width = s->width;
+  m_draw_height = s->height;
+}
+
+// Set picture pixel to a RGB value.
+void
+setPixelRgb (uint16_t xpos, uint16_t ypos, uint8_t r, uint8_t g,
+	     uint8_t b)
+{
+  uint8_t pixdata = colorFromRgb(r, g, b);
+
+  uint32_t byteaddress;
+
+  byteaddress = pixelAddr(xpos, ypos);
+  touchRange (byteaddress, byteaddress);
+  damage (xpos, ypos, 1, 1);
+  SpiRamWriteByte(byteaddress, pixdata);
+}
+
+void
+setPixelYuv (uint16_t xpos, uint16_t ypos, uint8_t color)
+{
+  uint32_t byteaddress = pixelAddr (xpos, ypos);
+  touchRange (byteaddress, byteaddress);
+  damage (xpos, ypos, 1, 1);
+  SpiRamWriteByte(byteaddress, color);
+}
+
+/* Draw LEN pixels of COLOR from (X, Y) to the right, in one
+   burst.  */
+
+void
+drawHSpan (uint16_t x, uint16_t y, uint16_t len, uint8_t color)
+{
+  uint32_t byteaddress = pixelAddr (x, y);
+
+  if (len == 0)
+    return;
+  touchRange (byteaddress, byteaddress + len - 1);
+  damage (x, y, len, 1);
+  SpiRamWriteBegin (byteaddress);
+  while (len--)
+    spi_transfer (color);
+  SpiRamWriteEnd ();
+}
+
+/* Write the LEN pixels at PIXELS from (X, Y) to the right, in one
+   burst.  */
+
+void
+writeSpan (uint16_t x, uint16_t y, const uint8_t *pixels, uint16_t len)
+{
+  uint32_t byteaddress = pixelAddr (x, y);
+
+  if (len == 0)
+    return;
+  touchRange (byteaddress, byteaddress + len - 1);
+  damage (x, y, len, 1);
+  SpiRamWriteBegin (byteaddress);
+  while (len--)
+    spi_transfer (*pixels++);
+  SpiRamWriteEnd ();
+}
+
+/* Draw LEN pixels of COLOR from (X, Y) down.  Long spans write the
+   top pixel and have the block mover copy it down line by line, 255
+   lines per move.  */
+
+void
+drawVSpan (uint16_t x, uint16_t y, uint16_t len, uint8_t color)
+{
+  damage (x, y, 1, len);
+  if (len < VSPAN_MOVE_MIN)
+    {
+      while (len--)
+	setPixelYuv (x, y++, color);
+      return;
+    }
+
+  setPixelYuv (x, y, color);
+  for (len--; len; )
+    {
+      uint8_t n = len > 255 ? 255 : len;
+
+      MoveBlock (x, y, x, y + 1, 1, n, 0);
+      y += n;
+      len -= n;
+    }
+}
+
+/* Source line readers of the drawBitmap functions: convert N pixels
+   from pixel FIRST on of the source line SRC to colours at OUT.  ARG
+   is the palette, if the format has one.  */
+
+typedef void (*bitmap_conv_t) (uint8_t *out, const uint8_t *src,
+			       uint16_t first, uint8_t n, const uint8_t *arg);
+
+static void
+convYuv (uint8_t *out, const uint8_t *src, uint16_t first, uint8_t n,
+	 const uint8_t *arg ATTRIBUTE_UNUSED)
+{
+  memcpy (out, src + first, n);
+}
+
+static void
+conv1bpp (uint8_t *out, const uint8_t *src, uint16_t first, uint8_t n,
+	  const uint8_t *arg)
+{
+  while (n--)
+    {
+      *out++ = (src[first >> 3] & (0x80 >> (first & 7))) ? arg[0] : arg[1];
+      first++;
+    }
+}
+
+static void
+conv4bpp (uint8_t *out, const uint8_t *src, uint16_t first, uint8_t n,
+	  const uint8_t *arg)
+{
+  while (n--)
+    {
+      uint8_t pair = src[first >> 1];
+
+      *out++ = arg[(first & 1) ? pair & 0xf : pair >> 4];
+      first++;
+    }
+}
+
+static void
+convRgb888 (uint8_t *out, const uint8_t *src, uint16_t first, uint8_t n,
+	    const uint8_t *arg ATTRIBUTE_UNUSED)
+{
+  src += first * 3;
+  while (n--)
+    {
+      *out++ = colorFromRgb (src[0], src[1], src[2]);
+      src += 3;
+    }
+}
+
+static void
+convRgb565 (uint8_t *out, const uint8_t *src, uint16_t first, uint8_t n,
+	    const uint8_t *arg ATTRIBUTE_UNUSED)
+{
+  const uint16_t *p = (const uint16_t *) src + first;
+
+  while (n--)
+    {
+      uint16_t c = *p++;
+
+      // Widen to 8 bits by repeating the top bits.
+      *out++ = colorFromRgb (((c >> 8) & 0xf8) | (c >> 13),
+			     ((c >> 3) & 0xfc) | ((c >> 9) & 3),
+			     ((c << 3) & 0xf8) | ((c >> 2) & 7));
+    }
+}
+
+/* Draw the W x H bitmap at SRC, lines STRIDE bytes apart, with its
+   top left corner at (X, Y), clipped to the draw surface.  CONV turns
+   the source into colours BITMAP_CHUNK pixels at a time, each line
+   is one write burst.  */
+
+static void
+drawBitmapLines (int16_t x, int16_t y, uint16_t w, uint16_t h,
+		 const uint8_t *src, uint16_t stride, bitmap_conv_t conv,
+		 const uint8_t *arg)
+{
+  uint8_t buf[BITMAP_CHUNK];
+  uint16_t first = 0;
+  uint32_t byteaddress;
+
+  if (x < 0)
+    {
+      if (-x >= w)
+	return;
+      first = -x;
+      w += x;
+      x = 0;
+    }
+  if (y < 0)
+    {
+      if (-y >= h)
+	return;
+      src += (uint32_t) stride * -y;
+      h += y;
+      y = 0;
+    }
+  if (x >= m_draw_width || y >= m_draw_height || w == 0 || h == 0)
+    return;
+  if (w > m_draw_width - x)
+    w = m_draw_width - x;
+  if (h > m_draw_height - y)
+    h = m_draw_height - y;
+
+  byteaddress = pixelAddr (x, y);
+  touchRange (byteaddress, byteaddress + m_pitch * (h - 1) + w - 1);
+  damage (x, y, w, h);
+  while (h--)
+    {
+      uint16_t done, i;
+
+      SpiRamWriteBegin (byteaddress);
+      for (done = 0; done < w; done += i)
+	{
+	  uint8_t n = (w - done < BITMAP_CHUNK) ? w - done : BITMAP_CHUNK;
+
+	  conv (buf, src, first + done, n, arg);
+	  for (i = 0; i < n; i++)
+	    spi_transfer (buf[i]);
+	}
+      SpiRamWriteEnd ();
+      byteaddress += m_pitch;
+      src += stride;
+    }
+}
+
+/* The drawBitmap functions draw a W x H bitmap with its top left
+   corner at (X, Y), clipped to the draw surface, one write burst per
+   line.  STRIDE is the distance between the source lines in bytes, 0
+   if they are packed.  The source may be in RAM or in flash that is
+   mapped into the address space.  This one takes colours as they are
+   stored in the frame buffer.  */
+
+void
+drawBitmapYuv (int16_t x, int16_t y, uint16_t w, uint16_t h,
+	       const uint8_t *pixels, uint16_t stride)
+{
+  drawBitmapLines (x, y, w, h, pixels, stride ? stride : w, convYuv, NULL);
+}
+
+/* One bit per pixel, most significant bit first; set bits are drawn
+   in FG, clear ones in BG.  */
+
+void
+drawBitmap1 (int16_t x, int16_t y, uint16_t w, uint16_t h,
+	     const uint8_t *bits, uint16_t stride, uint8_t fg, uint8_t bg)
+{
+  uint8_t colors[2] = { fg, bg };
+
+  drawBitmapLines (x, y, w, h, bits, stride ? stride : (w + 7) / 8,
+		   conv1bpp, colors);
+}
+
+/* Four bits per pixel, high nibble first, indexing the 16 colours at
+   PALETTE.  */
+
+void
+drawBitmap4 (int16_t x, int16_t y, uint16_t w, uint16_t h,
+	     const uint8_t *pixels, uint16_t stride, const uint8_t *palette)
+{
+  drawBitmapLines (x, y, w, h, pixels, stride ? stride : (w + 1) / 2,
+		   conv4bpp, palette);
+}
+
+/* Three bytes per pixel, red first.  */
+
+void
+drawBitmapRgb888 (int16_t x, int16_t y, uint16_t w, uint16_t h,
+		  const uint8_t *pixels, uint16_t stride)
+{
+  drawBitmapLines (x, y, w, h, pixels, stride ? stride : w * 3,
+		   convRgb888, NULL);
+}
+
+/* 16-bit RGB565 pixels, red in the top bits.  */
+
+void
+drawBitmapRgb565 (int16_t x, int16_t y, uint16_t w, uint16_t h,
+		  const uint16_t *pixels, uint16_t stride)
+{
+  drawBitmapLines (x, y, w, h, (const uint8_t *) pixels,
+		   stride ? stride : w * 2, convRgb565, NULL);
+}
+
+static void
+setBorderOp (uint32_t y, uint32_t uv)
+{
+  setBorder (y, uv);
+}
+
+void
+setBorder(uint8_t y, uint8_t uv)
+{
+  if (deferred (setBorderOp, y, uv, 4 + 2 * (FRPORCH - BLANKEND)))
+    return;
+  setBorder_i (y, uv, 0, FRPORCH - BLANKEND);
+}
+
+/* Clear the whole SRAM: one burst seeds the first CLEAR_SEED bytes,
+   then the block mover copies everything cleared so far behind it,
+   doubling the cleared area with every move (at most 255 x 255 bytes
+   each) instead of writing all 128KB over SPI.  */
+
+#define CLEAR_SEED 256
+
+static void
+clearSram (void)
+{
+  uint32_t filled = CLEAR_SEED;
+  uint16_t i;
+
+  SpiRamWriteBegin (0);
+  for (i = 0; i < CLEAR_SEED; i++)
+    spi_transfer (0);
+  SpiRamWriteEnd ();
+
+  while (filled < SRAM_SIZE)
+    {
+      uint32_t n = SRAM_SIZE - filled;
+      uint32_t rows;
+
+      if (n > filled)
+	n = filled;
+      rows = n / 255;
+      if (rows > 255)
+	rows = 255;
+      if (rows == 0)
+	{
+	  moveBlockRaw (0, filled, 0, n, 1, 2);
+	  filled += n;
+	}
+      else
+	{
+	  moveBlockRaw (0, filled, 0, 255, rows, 2);
+	  filled += rows * 255;
+	}
+    }
+  while (!blockFinished()) {}
+}
+
+/* Set number of lines, length of pixel and enable video generation.  */
+
+static void
+enableVideo (void)
+{
+  // The line count is TOTAL_LINES - 1 in the example, but the only
+  // value that doesn't produce a crap picture is 263 (even interlaced,
+  // PAL: 314), on both CRT and LCD displays, so we hard-code it here.
+
+  // XXX: PAL on Daewoo LCD TV, screen mode 1: 314 has no color noise,
+  //	but shifts one pixel up or down, depending on screen content;
+  //	"standard" 313 has color noise, but remains in place.
+  //	Does not seem to happen in other modes, may be a TV quirk.
+
+  int total_lines;
+  if (m_pal)
+    total_lines = 314;
+  else
+    total_lines = 263;
+  if (m_interlace)
+    total_lines *= 2;
+
+  SpiRamWriteRegister (VDCTRL2,
+		       (VDCTRL2_LINECOUNT * (total_lines + m_line_adjust))
+		       | (VDCTRL2_PIXEL_WIDTH * (PLLCLKS_PER_PIXEL - 1))
+		       | (m_pal ? VDCTRL2_PAL : 0)
+		       | (VDCTRL2_ENABLE_VIDEO));
+}
+
+/* Upload the prebuilt protolines of the current system, one burst
+   per line.  */
+
+static void
+writeProtolines (void)
+{
+  const struct protoline_t *p = vs23_protolines[m_pal][m_interlace];
+  uint16_t i, j, r;
+
+  for (j = 0; j < PROTOLINES; j++, p++)
+    {
+      SpiRamWriteBegin (PROTOLINE_BYTE_ADDRESS(j));
+      for (i = 0, r = 0; i <= COLORCLKS_PER_LINE; i++)
+	{
+	  while (i >= p->run[r].end)
+	    r++;
+	  spi_transfer16 (p->run[r].level);
+	}
+      SpiRamWriteEnd ();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Equivalent to Config
+// Initialize the VS32S0x0 chips in the mask CHANNELS, 0 for the
+// display channels; they all get the same commands.
+//
+void
+videoInit (uint8_t channels)
+{
+  uint16_t i;
+
+  if (channels == 0)
+    channels = m_displays;
+
+  // 1. Select the VS23s to set up for following commands in case
+  // there are several VS23 ICs connected to same SPI bus.
+  m_ic_mask = 0;
+  selectIcs (channels & ALL_CHANNELS);
+  m_channels = m_ic_mask;
+
+  // Disable video generation
+  SpiRamWriteRegister(VDCTRL2, 0);
+
+  // 2. Set SPI memory address autoincrement
+  SpiRamWriteByteRegister(WRITE_STATUS, 0x40);
+
+  // 4. Write picture start and end
+  SpiRamWriteRegister(PICSTART, (STARTPIX - 1));
+  SpiRamWriteRegister(PICEND, (ENDPIX - 1));
+
+  // 5. Enable PLL clock
+  SpiRamWriteRegister(VDCTRL1,
+		      (VDCTRL1_PLL_ENABLE) | (VDCTRL1_SELECT_PLL_CLOCK));
+  // 6. Clear the video memory
+  clearSram ();
+
+  // 7. Set length of one complete line (unit: PLL clocks)
+  SpiRamWriteRegister(LINELEN, (PLLCLKS_PER_LINE));
+  // 9. Define where Line Indexes are stored in memory
+  SpiRamWriteRegister(INDEXSTART, INDEX_START_LONGWORDS);
+
+  // 10. Enable the PAL Y lowpass filter, not used in NTSC
+  SpiRamWriteBMCtrl(BLOCKMVC1,0,0,BLOCKMVC1_PYF);
+  // 11. Set all line indexes to point to protoline 0 (which by
+  // definition is in the beginning of the SRAM)
+  for (i = 0; i < TOTAL_LINES; i++)
+    SetLineIndex(i, PROTOLINE_WORD_ADDRESS(0));
+
+  // At this time, the chip would continuously output the proto line 0.
+  // This protoline will become our most "normal" horizontal line.
+  // For TV-Out, fill the line with black level, and insert a few
+  // pixels of sync level (0) and color burst to the beginning.
+  // Note that the chip hardware adds black level to all nonproto
+  // areas so protolines and normal picture have different meaning for
+  // the same Y value.
+  // In protolines, Y=0 is at sync level and in normal picture Y=0 is at
+  // black level (offset +102).
+
+  // In protolines, each pixel is 8 PLLCLKs, which in TV-out modes
+  // means one color subcarrier cycle.  Each pixel has 16 bits (one
+  // word):
+  // VVVVUUUUYYYYYYYY.
+
+  // Interlaced: protoline 0 is used for most of the picture.
+  // Protoline 1 has a similar first half than 0, but the end has a
+  // short sync pulse.  This is used for line 623.  Protoline 2 has a
+  // normal sync and color burst and nothing else.  It is used between
+  // vertical sync lines and visible lines, but is not mandatory
+  // always.  Protolines 3 to 6 are the short+short, long+long,
+  // long+short and short+long VSYNC lines and 7 is just a short sync.
+  // Progressive: protoline 0 is the picture line, 1 to 3 are the
+  // short+short, long+long and long+short VSYNC lines.
+  writeProtolines ();
+
+  setColorSpace(1);
+
+  // 12. Now set first eight lines of frame to point to NTSC sync lines
+  // Here the frame starts, lines 1 and 2
+  if (m_interlace) {
+    if (m_pal) {
+      for (i=0; i<2; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
+      }
+      // Line 3
+      SetLineIndex(2, PROTOLINE_WORD_ADDRESS(5));
+      // Lines 4 and 5
+      for (i=3; i<5; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      // At this point, lines 0 to 4 are VSYNC lines and all other lines are proto0.
+
+      // Another batch of VSYNC lines is made between the two fields of interlaced PAL picture.
+      // The lines start from 310.
+      for (i=FIELD1START; i<FIELD1START+2; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      SetLineIndex(FIELD1START+2, PROTOLINE_WORD_ADDRESS(6));
+      for (i=FIELD1START+3; i<FIELD1START+5; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
+      }
+      for (i=FIELD1START+5; i<FIELD1START+7; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      SetLineIndex(FIELD1START+7, PROTOLINE_WORD_ADDRESS(7));
+
+      // Set empty lines with sync and color burst to beginning of both frames.
+      for (i=5; i<FRONT_PORCH_LINES; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+      for (i=FIELD1START+8; i<FIELD1START+FRONT_PORCH_LINES+2; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+
+      // These are the three last lines of the frame, lines 623-625
+      SetLineIndex(TOTAL_LINES-1-3, PROTOLINE_WORD_ADDRESS(1));
+      for (i=TOTAL_LINES-1-2; i<=TOTAL_LINES-1; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+    } else {
+      for (i = 0; i < 3; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      // Lines 4 to 6
+      for (i = 3; i < 6; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
+      }
+      // Lines 7 to 9
+      for (i = 6; i < 9; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      // At this point, lines 0 to 8 are VSYNC lines and all other lines are
+      // proto0.
+
+      // Another batch of VSYNC lines is made between the two fields of
+      // interlaced NTSC picture.
+      // The lines start from 261.
+      SetLineIndex(FIELD1START, PROTOLINE_WORD_ADDRESS(1));
+      for (i = FIELD1START + 1; i < FIELD1START + 3; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      SetLineIndex(FIELD1START + 3, PROTOLINE_WORD_ADDRESS(6));
+      for (i = FIELD1START + 4; i < FIELD1START + 6; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(4));
+      }
+      SetLineIndex(FIELD1START + 6, PROTOLINE_WORD_ADDRESS(5));
+      for (i = FIELD1START + 7; i < FIELD1START + 9; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(3));
+      }
+      SetLineIndex(FIELD1START + 9, PROTOLINE_WORD_ADDRESS(7));
+
+      // Set empty lines with sync and color burst to beginning of both
+      // frames.
+      for (i = 9; i < FRONT_PORCH_LINES; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+      for (i = FIELD1START + 10; i < FIELD1START + FRONT_PORCH_LINES; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+    }
+  } else {	// interlace
+    if (m_pal) {
+      // For progressive PAL case, this is quite a minimum case.
+      // Here the frame starts, lines 1 and 2
+      for (i=0; i<2; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+      // Line 3
+      SetLineIndex(2, PROTOLINE_WORD_ADDRESS(3));
+      // Lines 4 and 5
+      for (i=3; i<5; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
+      }
+      // These are three last lines of the frame, lines 310-312
+      for (i=TOTAL_LINES-3; i<TOTAL_LINES; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
+      }
+    } else {
+      // For progressive NTSC case, this is quite a minimum case.
+      // Here the frame starts, lines 1 to 3
+      for (i = 0; i < 3; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
+      }
+      // Lines 4 to 6
+      for (i = 3; i < 6; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(2));
+      }
+      // Lines 7 to 9
+      for (i = 6; i < 9; i++) {
+	SetLineIndex(i, PROTOLINE_WORD_ADDRESS(1));
+      }
+    }
+  }
+
+  // 13. Set pic line indexes to point to protoline 0 and their
+  // individual picture line, replicated LINEREP times.
+  // In interlaced case in both fields the same area is picture box
+  // area.
+  // XXX: In PAL example, it says "TOTAL_LINES/2" instead of FIELD1START
+  for (i = 0; i < m_bands; i++)
+    writeBandIndex (&m_band[i]);
+
+  // 14. Set number of lines, length of pixel and enable video
+  // generation
+  enableVideo ();
+
+  m_video_on = true;
+  m_video_pal = m_pal;
+  m_video_interlace = m_interlace;
+  m_frame_us = 0;
+}
+
+void
+videoBegin (bool interlace, bool lowpass, uint8_t system)
+{
+  m_vsync_enabled = false;
+  m_interlace = interlace;
+  m_lowpass = lowpass;
+  m_pal = system != 0;
+  m_line_adjust = 0;
+  m_gpio_state = 0xf;
+  m_video_on = false;
+  m_ic_mask = 0;
+  m_channels = m_displays;
+  selectIcs (m_displays);
+
+  SpiRamWriteRegister (WRITE_GPIO_CTRL, m_gpio_state);
+
+  setMode(1);
+}
+
+/* Show the picture on the VS23s in the mask CHANNELS, bit n for
+   channel n, from the next setMode on; the default is channel 0.
+   They are set up alike and get all drawing at once, so one frame is
+   mirrored on several displays for the SPI time of one.  Displays
+   left out are switched off.  The driver does not touch the other
+   channels, their SRAM is free for sramWrite, sramRead and
+   sramCopy.  */
+
+void
+setDisplays (uint8_t channels)
+{
+  uint8_t off = m_displays & ~channels;
+
+  channels &= ALL_CHANNELS;
+  if (channels == 0 || channels == m_displays)
+    return;
+  if (off)
+    {
+      selectIcs (off);
+      SpiRamWriteRegister (VDCTRL2, 0);
+      selectIcs (m_channels);
+    }
+  m_displays = channels;
+  // Displays that are new need the whole set-up.
+  m_video_on = false;
+}
+
+/* Send drawing, block moves and register writes to the display
+   channels in the mask CHANNELS only, for example to show different
+   pictures; 0 selects all of them again, as does setMode.  All
+   displays share the mode and the SRAM layout.  A lazy clearScreen
+   is finished first, as it belongs to the channels it was started on.
+   Returns the previous mask.  */
+
+uint8_t
+selectChannels (uint8_t channels)
+{
+  uint8_t old = m_channels;
+
+  channels &= m_displays;
+  if (channels == 0)
+    channels = m_displays;
+  if (channels != m_channels)
+    {
+      clearScreenFlush ();
+      // The atlas of a newly selected channel is not rendered.
+      glyphCacheClear ();
+      m_channels = channels;
+      selectIcs (channels);
+    }
+  return old;
+}
+
+void
+videoReset (void)
+{
+  setColorSpace(1);
+}
+
+void setSyncLine (uint16_t line)
+{
+  m_vsync_armed = false;
+  if (line == 0) {
+    m_vsync_enabled = false;
+  } else {
+    m_sync_line = line;
+    m_vsync_enabled = true;
+  }
+}
+
+/* The scan line the VS23 is on, counted through the whole frame.  */
+
+static inline uint16_t
+scanLine (void)
+{
+  return SpiRamReadRegister(CURLINE) & 0xfff;
+}
+
+/* The scan line, counted from the start of the field if interlaced.
+   Field 1 starts at FIELD1START, so the fields of NTSC have 261 and
+   264 lines and those of PAL 310 and 315.  */
+
+uint16_t currentLine (void)
+{
+  uint16_t cl = scanLine ();
+  if (m_interlace && cl >= FIELD1START)
+    cl -= FIELD1START;
+  return cl;
+}
+
+/* Wait for the beam to enter a new line and return it, together with
+   the time that happened in *US.  In whole frame numbering if
+   FRAME.  */
+
+static uint16_t
+beamEdge (uint32_t *us, bool frame)
+{
+  uint16_t line = frame ? scanLine () : currentLine ();
+  uint16_t next;
+
+  while ((next = frame ? scanLine () : currentLine ()) == line) {}
+  *us = micros ();
+  return next;
+}
+
+/* Anchor the beam predictor at the start of the current line.  The
+   first call after videoInit also measures the frame period, sleeping
+   through most of the frame instead of polling CURLINE.  The fields of
+   an interlaced frame differ in length, so the period is measured over
+   the whole frame and a field is taken to be half of it.  */
+
+void
+beamSync (void)
+{
+  if (!m_frame_us)
+    {
+      uint32_t start, us;
+      uint16_t line = beamEdge (&start, true);
+
+      delay ((uint32_t) (TOTAL_LINES - 16) * LINE_LENGTH_NS / 1000000);
+      while (beamEdge (&us, true) != line) {}
+      m_frame_us = (us - start) / (m_interlace ? 2 : 1);
+      m_frame_lines = ((uint32_t) m_frame_us * 1000 + LINE_LENGTH_NS / 2)
+	/ LINE_LENGTH_NS;
+    }
+  m_beam_line = beamEdge (&m_beam_us, false);
+  m_beam_checked = m_beam_us;
+}
+
+/* Lines the prediction may be off before beamLine re-syncs.  Line
+   numbers of the interlaced fields drift by half their difference in
+   length against the average field the predictor runs on.  */
+
+static inline uint16_t
+beamDrift (void)
+{
+  if (!m_interlace)
+    return BEAM_DRIFT_LINES;
+  return BEAM_DRIFT_LINES + (TOTAL_LINES - 2 * FIELD1START + 1) / 2;
+}
+
+/* Where the beam is now, in the numbering of currentLine, predicted
+   from micros() without touching the SPI bus.  Every BEAM_CHECK_US the
+   prediction is compared with CURLINE and re-synced if it is off by
+   more than BEAM_DRIFT_LINES.  */
+
+uint16_t
+beamLine (void)
+{
+  uint32_t now;
+  uint16_t line;
+
+  if (!m_frame_us)
+    beamSync ();
+
+  now = micros ();
+  line = (m_beam_line + (uint32_t) ((now - m_beam_us) % m_frame_us)
+	  * m_frame_lines / m_frame_us) % m_frame_lines;
+
+  if (now - m_beam_checked >= BEAM_CHECK_US)
+    {
+      uint16_t real = currentLine ();
+      uint16_t off = (real + m_frame_lines - line) % m_frame_lines;
+
+      m_beam_checked = now;
+      if (off > beamDrift () && off < m_frame_lines - beamDrift ())
+	{
+	  beamSync ();
+	  return m_beam_line;
+	}
+      return real;
+    }
+  return line;
+}
+
+/* Duration of a frame (a field if interlaced) in microseconds.  */
+
+uint32_t
+frameMicros (void)
+{
+  if (!m_frame_us)
+    beamSync ();
+  return m_frame_us;
+}
+
+/* Busy-wait, without touching the SPI bus, until the beam predictor
+   reaches scan line LINE.  */
+
+static void
+waitBeam (uint16_t line)
+{
+  uint16_t togo = (line + m_frame_lines - beamLine ()) % m_frame_lines;
+  uint32_t start = micros ();
+  uint32_t us = (uint32_t) togo * LINE_LENGTH_NS / 1000;
+
+  while (micros () - start < us) {}
+}
+
+/* Race the beam from behind: call WRITE for frame buffer lines FIRST
+   to FIRST + COUNT - 1, top to bottom, each once the beam has scanned
+   it in the current frame; in the vertical blank below the picture
+   all lines are free.  A writer that keeps up with the beam thus
+   changes a line only after it was shown and the update appears whole
+   in the next frame.  A slower one is lapped by the beam, it then may
+   also write lines the beam will not reach before WRITE returns, as
+   timed from its previous call, instead of waiting for the beam to
+   pass them again.  Either way no line is written while the beam is
+   on it.  This assumes the frame buffer is shown unscrolled from the
+   top of the picture, as setMode leaves it.  */
+
+void
+chaseBeam (uint16_t first, uint16_t count, void (*write) (uint16_t y))
+{
+  uint16_t y = first, end = first + count;
+  uint16_t cost = 0xffff;	// Not timed yet, write behind only
+
+  if (!m_frame_us)
+    beamSync ();
+
+  while (y < end)
+    {
+      uint16_t line = beamLine ();
+      uint16_t top = STARTLINE + y * LINEREP / PICFIELDS;
+      uint16_t passed;
+
+      if (line >= ENDLINE)
+	passed = end;
+      else if (line < STARTLINE + LINEREP)
+	passed = 0;
+      else
+	passed = (line - STARTLINE) * PICFIELDS / LINEREP;
+
+      // Look again after every line, the beam may lap a slow WRITE.
+      if (passed > y || (line < top && top - line > cost))
+	{
+	  uint32_t start = micros ();
+
+	  write (y++);
+	  cost = (micros () - start) * 1000 / LINE_LENGTH_NS + 2;
+	}
+      else
+	waitBeam (top + (LINEREP + PICFIELDS - 1) / PICFIELDS);
+    }
+}
+
+/* Microseconds until the beam leaves the vertical blank, less a line
+   to spare; 0 if it is in the picture.  The sync line can be a few
+   lines above the end of the picture, that much is waited for.  */
+
+static uint32_t
+blankLeft (void)
+{
+  uint16_t line = beamLine ();
+  uint16_t togo;
+
+  if (line >= STARTLINE && line < ENDLINE
+      && ENDLINE - line <= DEFER_WAIT_LINES)
+    {
+      waitBeam (ENDLINE);
+      line = ENDLINE;
+    }
+  if (line >= ENDLINE)
+    togo = m_frame_lines - line + STARTLINE;
+  else if (line < STARTLINE)
+    togo = STARTLINE - line;
+  else
+    return 0;
+  return (uint32_t) (togo - 1) * LINE_LENGTH_NS / 1000;
+}
+
+/* Run the queued groups of deferred calls, in order, as long as they
+   fit into BUDGET microseconds by the measured SPI speed; the first
+   group always runs.  ALL runs everything, including a group still
+   open.  */
+
+static void
+runDeferred (uint32_t budget, bool all)
+{
+  bool first = true;
+
+  m_defer_running = true;
+  while (m_defer_count)
+    {
+      uint32_t bytes = 0, start, us, ns;
+      uint8_t n = 0;
+      bool end = false;
+
+      while (n < m_defer_count && !end)
+	{
+	  const struct defer_op_t *op
+	    = &m_defer_op[(m_defer_head + n++) % MAX_DEFERRED];
+
+	  bytes += op->bytes;
+	  end = op->end;
+	}
+      if (!all && (!end || (!first && bytes * m_byte_ns / 1000 > budget)))
+	break;
+
+      start = micros ();
+      while (n--)
+	{
+	  const struct defer_op_t *op = &m_defer_op[m_defer_head];
+
+	  m_defer_head = (m_defer_head + 1) % MAX_DEFERRED;
+	  m_defer_count--;
+	  selectIcs (op->channels);
+	  op->run (op->a, op->b);
+	}
+      selectIcs (m_channels);
+      us = micros () - start;
+
+      // Follow a slower bus at once, a faster one gradually.
+      ns = bytes ? us * 1000 / bytes : m_byte_ns;
+      if (ns > m_byte_ns)
+	m_byte_ns = ns < 0xffff ? ns : 0xffff;
+      else
+	m_byte_ns -= (m_byte_ns - ns) / 8;
+      budget = us < budget ? budget - us : 0;
+      first = false;
+    }
+  m_defer_running = false;
+}
+
+/* Queue a call of RUN (A, B) that sends about BYTES over SPI, to be
+   run in a vertical blank; see deferBegin.  Outside deferBegin and
+   deferEnd it is a group of its own.  If the queue is full this
+   waits for a blank to make room.  A group is never split: if the
+   open group fills the whole queue on its own, the call is not queued
+   and this returns false.  Without a sync line, while a mode is being
+   set, the queue is run at once.  */
+
+bool
+deferCall (void (*run) (uint32_t, uint32_t), uint32_t a, uint32_t b,
+	   uint16_t bytes)
+{
+  struct defer_op_t *op;
+
+  if (!m_vsync_enabled)
+    {
+      runDeferred (UINT32_MAX, true);
+      m_defer_running = true;
+      run (a, b);
+      m_defer_running = false;
+      return true;
+    }
+
+  while (m_defer_count == MAX_DEFERRED)
+    {
+      uint8_t i;
+      bool end = false;
+
+      for (i = 0; i < m_defer_count; i++)
+	end |= m_defer_op[(m_defer_head + i) % MAX_DEFERRED].end;
+      if (!end)
+	return false;
+      waitVsync ();
+    }
+
+  op = &m_defer_op[(m_defer_head + m_defer_count++) % MAX_DEFERRED];
+  op->run = run;
+  op->a = a;
+  op->b = b;
+  op->bytes = bytes;
+  op->channels = m_channels;
+  op->end = !m_defer_open;
+  return true;
+}
+
+/* The driver functions that change the whole picture at once call
+   this first: between deferBegin and deferEnd they queue themselves
+   and return true.  A call that does not fit into the group any more
+   returns false and takes effect at once.  */
+
+static bool
+deferred (void (*run) (uint32_t, uint32_t), uint32_t a, uint32_t b,
+	  uint16_t bytes)
+{
+  if (!m_defer_open || m_defer_running)
+    return false;
+  return deferCall (run, a, b, bytes);
+}
+
+/* The last call queued in the open group, to be extended instead of
+   queueing another one, or NULL.  */
+
+static struct defer_op_t *
+deferTail (void)
+{
+  if (!m_defer_open || m_defer_running || m_defer_count == 0)
+    return NULL;
+  return &m_defer_op[(m_defer_head + m_defer_count - 1) % MAX_DEFERRED];
+}
+
+/* Changing the border, colour space or line index while the picture
+   is drawn shows half the old and half the new state.  Between
+   deferBegin and deferEnd, setBorder, setColorSpace, SetLineIndex,
+   SetPicIndex, mapPicLines, bindPicBuffer, scrollPicBuffer and the
+   line index changes of clearScreen do not touch the chip but queue
+   themselves as one group, of up to MAX_DEFERRED calls.  The groups run in order when a
+   frame is counted (waitVsync, pollFrame, frameCount or frameSync)
+   with the beam in the vertical blank, each whole within one blank.
+   A group that does not fit into what is left of the blank, or into
+   the budget set by setDeferBudget, waits for the next blank; only
+   the first group of a blank may overrun it.  */
+
+void
+deferBegin (void)
+{
+  m_defer_open = true;
+}
+
+void
+deferEnd (void)
+{
+  m_defer_open = false;
+  if (m_defer_count)
+    m_defer_op[(m_defer_head + m_defer_count - 1) % MAX_DEFERRED].end = true;
+}
+
+/* Limit the time deferred calls may take per blank to US microseconds,
+   leaving the rest of the blank to the application.  0 allows the
+   whole blank.  */
+
+void
+setDeferBudget (uint16_t us)
+{
+  m_defer_budget = us;
+}
+
+/* Number of deferred calls that have not run yet.  */
+
+uint8_t
+deferPending (void)
+{
+  return m_defer_count;
+}
+
+/* End the current group and wait until all deferred calls have run.  */
+
+void
+deferFlush (void)
+{
+  deferEnd ();
+  while (m_defer_count)
+    {
+      if (m_vsync_enabled)
+	waitVsync ();
+      else
+	runDeferred (UINT32_MAX, true);
+    }
+}
+
+/* Work out when the beam passes the sync line next, from the beam
+   predictor.  */
+
+static void
+armVsync (void)
+{
+  uint16_t line = beamLine ();
+  uint16_t togo = (m_sync_line + m_frame_lines - line) % m_frame_lines;
+
+  if (togo == 0)
+    togo = m_frame_lines;
+  m_vsync_us = micros () + (uint32_t) togo * LINE_LENGTH_NS / 1000;
+  m_vsync_armed = true;
+}
+
+/* Count the frames whose sync line has passed since the last call and
+   run the frame callback once if there were any.  Returns the number
+   of frames.  */
+
+static uint16_t
+frameCheck (void)
+{
+  uint32_t now, next;
+  uint16_t passed;
+
+  if (!m_vsync_enabled)
+    return 0;
+  if (!m_vsync_armed)
+    {
+      armVsync ();
+      return 0;
+    }
+  now = micros ();
+  if ((int32_t) (now - m_vsync_us) < 0)
+    return 0;
+
+  passed = 1 + (now - m_vsync_us) / m_frame_us;
+  m_frames += passed;
+  // Re-arm from the predictor, so its re-syncs carry over, but do not
+  // let a prediction a few lines short count this pass again.
+  next = m_vsync_us + passed * m_frame_us;
+  armVsync ();
+  if ((int32_t) (m_vsync_us - (next - m_frame_us / 2)) < 0)
+    m_vsync_us += m_frame_us;
+  if (m_defer_count)
+    {
+      uint32_t left = blankLeft ();
+
+      if (m_defer_budget && left > m_defer_budget)
+	left = m_defer_budget;
+      if (left)
+	runDeferred (left, false);
+    }
+  if (m_frame_callback)
+    m_frame_callback ();
+  return passed;
+}
+
+/* Run CALLBACK once per frame, when the beam has passed the sync line
+   set by the mode.  It is called from waitVsync, pollFrame and
+   frameSync, not from an interrupt.  NULL removes it.  */
+
+void
+setFrameCallback (void (*callback) (void))
+{
+  m_frame_callback = callback;
+}
+
+/* True if the beam has passed the sync line since the last poll.  */
+
+bool
+pollFrame (void)
+{
+  return frameCheck () != 0;
+}
+
+/* Wait until the beam passes the sync line, without reading CURLINE
+   while waiting.  Returns at once if there is no sync line, which is
+   the case while a mode is being set.  */
+
+void
+waitVsync (void)
+{
+  if (!m_vsync_enabled)
+    return;
+  frameCheck ();
+  while (!frameCheck ())
+    {
+      uint32_t now = micros ();
+
+      // Sleep through all but the last millisecond.
+      if ((int32_t) (m_vsync_us - now) > 2000)
+	delay ((m_vsync_us - now) / 1000 - 1);
+    }
+}
+
+/* Number of sync line passes seen so far.  */
+
+uint32_t
+frameCount (void)
+{
+  frameCheck ();
+  return m_frames;
+}
+
+/* Fixed-rate loop helper: wait until the beam passes the sync line
+   PERIOD frames after the previous call returned and return how many
+   of these passes the caller missed, 0 if it kept up.  A late caller
+   returns at once and is not made to catch up.  The first call after
+   a mode is set counts from the current frame.  */
+
+uint16_t
+frameSync (uint8_t period)
+{
+  uint32_t now = frameCount ();
+  uint32_t due;
+
+  if (!m_vsync_enabled)
+    return 0;
+  if (!m_loop_started)
+    {
+      m_loop_frame = now;
+      m_loop_started = true;
+    }
+  due = m_loop_frame + period;
+  if ((int32_t) (now - due) >= 0)
+    {
+      m_loop_frame = now;
+      return now - due + 1;
+    }
+  while ((int32_t) (m_frames - due) < 0)
+    waitVsync ();
+  m_loop_frame = m_frames;
+  return 0;
+}
+
+/* Work out where MODE puts protolines, line index and picture lines
+   for the given system and how much SRAM remains.  Returns false if
+   the mode does not fit into the SRAM or the picture area.  */
+
+bool
+planLayout (const struct video_mode_t *mode, bool pal, bool interlace,
+	    struct mem_layout_t *l)
+{
+  const struct video_mode_t *cur_mode = m_current_mode;
+  bool cur_pal = m_pal;
+  bool cur_interlace = m_interlace;
+  bool fits;
+
+  // The layout macros follow the current settings, switch them over
+  // to the planned ones while evaluating.
+  m_current_mode = mode;
+  m_pal = pal;
+  m_interlace = interlace;
+
+  l->protolines = PROTOLINES;
+  l->proto_bytes = PROTO_AREA_WORDS * 2;
+  l->index_start = INDEX_START_BYTES;
+  l->index_bytes = TOTAL_LINES * 3;
+  l->picline_start = PICLINE_START;
+  l->picline_bytes = PICLINE_LENGTH_BYTES;
+  l->bextra = BEXTRA;
+  l->pitch = PICLINE_BYTE_ADDRESS(1) - PICLINE_BYTE_ADDRESS(0);
+  l->piclines = YPIXELS;
+  l->frame_bytes = (uint32_t) l->pitch * YPIXELS;
+  l->free_start = (PICLINE_BYTE_ADDRESS(YPIXELS) + 1) & ~1UL;
+  l->max_piclines = PICLINE_START < SRAM_SIZE ? PICLINE_MAX : 0;
+  // Progressive PAL ends with three sync lines.  Alternate lines per
+  // field need interlace and the same number of lines in both fields.
+  fits = l->free_start <= SRAM_SIZE && YPIXELS <= MAX_PICLINES
+    && ENDLINE <= (interlace ? FIELD1START : TOTAL_LINES - (pal ? 3 : 0))
+    && mode->top >= MIN_TOP
+    && (!mode->fieldlines || (interlace && PICSCANS % 2 == 0));
+
+  m_current_mode = cur_mode;
+  m_pal = cur_pal;
+  m_interlace = cur_interlace;
+
+  l->free_bytes = fits ? SRAM_SIZE - l->free_start : 0;
+  l->extra_frames = l->frame_bytes ? l->free_bytes / l->frame_bytes : 0;
+  return fits;
+}
+
+/* Layout of the current mode.  */
+
+const struct mem_layout_t *
+currentLayout (void)
+{
+  return &m_layout;
+}
+
+/* Generate a mode of WIDTH x HEIGHT picture lines, each shown on VREP
+   scan lines, for the current system.  The picture is centred between
+   the blanking end and the front porch and between the vertical sync
+   lines.  VCLKPP is the number of PLL clocks per pixel, 0 picks the
+   widest pixels that fit.  BEXTRA starts at 8 bytes and is reduced if
+   the frame buffer would not fit into SRAM otherwise.  If interlaced
+   and the picture is higher than a field, the fields show alternate
+   lines.  Returns false if no such mode is possible.  */
+
+bool
+makeMode (uint16_t width, uint16_t height, uint8_t vclkpp, uint8_t vrep,
+	  struct video_mode_t *mode)
+{
+  uint16_t area = FRPORCH - BLANKEND;
+  uint16_t lines = (m_interlace ? FIELD1START : TOTAL_LINES - (m_pal ? 3 : 0))
+    - FRONT_PORCH_LINES - MIN_TOP;
+  uint16_t piclen;
+  uint8_t fields;
+  struct mem_layout_t layout;
+
+  if (width == 0 || height == 0)
+    return false;
+  if (vrep == 0)
+    vrep = 1;
+  if (vclkpp == 0)
+    vclkpp = (area * 8UL / width > 16) ? 16 : area * 8 / width;
+  piclen = (uint32_t) vclkpp * width / 8;
+  fields = (m_interlace && (uint32_t) height * vrep > lines) ? 2 : 1;
+  if (vclkpp == 0 || vclkpp > 16 || piclen > area
+      || (uint32_t) height * vrep > (uint32_t) lines * fields)
+    return false;
+
+  mode->x = width;
+  mode->y = height;
+  mode->vclkpp = vclkpp;
+  mode->vrep = vrep;
+  mode->fieldlines = fields == 2;
+  mode->left = (area - piclen) / 2;
+  mode->top = MIN_TOP + (lines - height * vrep / fields) / 2;
+
+  for (mode->bextra = 8; ; mode->bextra -= 2)
+    {
+      if (planLayout (mode, m_pal, m_interlace, &layout))
+	return true;
+      if (mode->bextra == 0)
+	return false;
+    }
+}
+
+/* Point scan lines FIRST to FIRST + COUNT - 1 of both fields back at
+   protoline 0.  */
+
+static void
+resetPicIndex (uint16_t first, uint16_t count)
+{
+  uint16_t field, i;
+
+  for (field = 0; field < (m_interlace ? 2 : 1); field++)
+    {
+      SpiRamWriteBegin (INDEX_START_BYTES + (first + field * FIELD1START) * 3);
+      for (i = 0; i < count * 3; i++)
+	spi_transfer (0);
+      SpiRamWriteEnd ();
+    }
+}
+
+/* Fill W x H bytes, lines PITCH bytes apart, from ADDR on with COLOR:
+   one burst seeds the first line, the block mover copies it down.  */
+
+static void
+fillArea (uint32_t addr, uint16_t pitch, uint16_t w, uint16_t h,
+	  uint8_t color)
+{
+  uint16_t x, y, n, k;
+
+  SpiRamWriteBegin (addr);
+  for (x = 0; x < w; x++)
+    spi_transfer (color);
+  SpiRamWriteEnd ();
+
+  for (x = 0; x < w; x += n)
+    {
+      n = (w - x > 255) ? 255 : w - x;
+      for (y = 0; y + 1 < h; y += k)
+	{
+	  k = (h - 1 - y > 255) ? 255 : h - 1 - y;
+	  moveBlockRaw (addr + (uint32_t) y * pitch + x,
+			addr + (uint32_t) (y + 1) * pitch + x, pitch, n, k, 0);
+	}
+    }
+}
+
+/* Move the frame buffer content of the previous mode, OLD_WIDTH x
+   OLD_HEIGHT pixels with lines OLD_PITCH bytes apart, to the pitch of
+   the current mode, and blacken what the previous mode did not have.
+   Both start at the same address.  Lines move away from line 0 one
+   after the other, the moves never overwrite a line still to go.  */
+
+static void
+keepFrame (uint16_t old_pitch, uint16_t old_width, uint16_t old_height)
+{
+  uint32_t base = m_first_line_addr;
+  uint16_t w = (old_width < XPIXELS) ? old_width : XPIXELS;
+  uint16_t h = (old_height < YPIXELS) ? old_height : YPIXELS;
+  uint16_t x, y, n;
+
+  if (m_pitch < old_pitch)
+    for (y = 1; y < h; y++)
+      for (x = 0; x < w; x += n)
+	{
+	  n = (w - x > 255) ? 255 : w - x;
+	  moveBlockRaw (base + (uint32_t) y * old_pitch + x,
+			base + (uint32_t) y * m_pitch + x, n, n, 1, 0);
+	}
+  else if (m_pitch > old_pitch)
+    for (y = h - 1; y > 0; y--)
+      for (x = w; x > 0; x -= n)
+	{
+	  n = (x > 255) ? 255 : x;
+	  moveBlockRaw (base + (uint32_t) y * old_pitch + x - 1,
+			base + (uint32_t) y * m_pitch + x - 1, n, n, 1, 1);
+	}
+
+  if (w < XPIXELS)
+    fillArea (base + w, m_pitch, XPIXELS - w, h, 0);
+  if (h < YPIXELS)
+    fillArea (base + (uint32_t) h * m_pitch, m_pitch, XPIXELS, YPIXELS - h, 0);
+  while (!blockFinished()) {}
+}
+
+/* Switch to MODE.  If the chip already runs the same system and scan
+   type, the sync setup stays as it is: only the picture area, the
+   pixel width and the picture line indexes are rewritten, and the
+   display does not have to lock on again.  KEEP then carries the frame
+   buffer content over as far as it fits into the new mode, otherwise
+   the new frame buffer is cleared.  Off-screen allocations do not
+   survive a mode switch.  */
+
+bool
+changeMode (const struct video_mode_t *mode, bool keep)
+{
+  static struct video_mode_t current;
+  struct mem_layout_t layout;
+  bool incremental = m_video_on && m_video_pal == m_pal
+    && m_video_interlace == m_interlace;
+  uint16_t old_start = 0, old_lines = 0, old_pitch = 0;
+  uint16_t old_width = 0, old_height = 0;
+  uint8_t i;
+
+  if (!planLayout (mode, m_pal, m_interlace, &layout))
+    return false;
+
+  // Deferred calls were made for the old mode.
+  runDeferred (UINT32_MAX, true);
+  selectChannels (0);
+  m_loop_started = false;
+
+  if (incremental)
+    {
+      clearScreenFlush ();
+      old_start = STARTLINE;
+      old_lines = SCANLINES;
+      old_pitch = m_picbuf[0].surf.pitch;
+      old_width = m_picbuf[0].surf.width;
+      old_height = m_picbuf[0].surf.height;
+    }
+
+  setSyncLine(0);
+
+  m_layout = layout;
+  current = *mode;
+  m_current_mode = &current;
+  m_first_line_addr = m_layout.picline_start;
+  m_pitch = m_layout.pitch;
+
+  // The rest of the SRAM is handed out by sramAlloc.
+  m_sram_start = m_layout.free_start;
+  m_sram_blocks = 0;
+  m_glyph_atlas = 0;
+  m_glyph_slots = 0;
+  free (m_glyph_slot);
+  m_glyph_slot = NULL;
+  m_clear_line = 0;
+  m_clear_lines = 0;
+  m_clear_x = XPIXELS;
+  m_dirty_count = 0;
+
+  // The frame buffer is picture buffer 0, shown on all picture lines.
+  m_picbuf[0].surf.base = m_first_line_addr;
+  m_picbuf[0].surf.pitch = m_pitch;
+  m_picbuf[0].surf.width = XPIXELS;
+  m_picbuf[0].surf.height = YPIXELS;
+  m_picbuf[0].scroll = 0;
+  m_draw_width = XPIXELS;
+  m_draw_height = YPIXELS;
+  m_picbufs = 1;
+  m_band[0].first = 0;
+  m_band[0].count = PICSCANS;
+  m_band[0].buf = 0;
+  m_band[0].phase = 0;
+  m_band[0].y = 0;
+  m_bands = 1;
+
+  if (incremental)
+    {
+      SpiRamWriteRegister(PICSTART, (STARTPIX - 1));
+      SpiRamWriteRegister(PICEND, (ENDPIX - 1));
+      enableVideo ();
+      if (keep)
+	keepFrame (old_pitch, old_width, old_height);
+      resetPicIndex (old_start, old_lines);
+      if (keep)
+	for (i = 0; i < m_bands; i++)
+	  writeBandIndex (&m_band[i]);
+      else
+	clearScreen (0);
+    }
+  else
+    {
+      videoInit(0);
+
+      // Sony KX-14CP1 and possibly other displays freak out if we start
+      // drawing stuff before they had a chance to synchronize with the
+      // new mode, so we give them a few frames.  The application can
+      // load its assets meanwhile, see videoReady.
+      m_ready_at = millis() + 160;
+    }
+
+  // Start the new frame at the end of the visible screen plus a little extra.
+  // Used to be two-thirds down the screen, but that caused more flicker when
+  // the rendering load changes drastically.
+  setSyncLine(SCANLINES + m_current_mode->top + 16);
+
+  return true;
+}
+
+/* Switch to MODE, which is copied, for example one made by
+   makeMode.  */
+
+bool
+setCustomMode (const struct video_mode_t *mode)
+{
+  return changeMode (mode, false);
+}
+
+/* True once the display had time to lock onto the mode.  */
+
+bool
+videoReady (void)
+{
+  return (long)(millis() - m_ready_at) >= 0;
+}
+
+void
+waitVideoReady (void)
+{
+  while (!videoReady()) {}
+}
+
+bool
+setMode (uint8_t mode)
+{
+  if (mode >= sizeof (modes_ntsc) / sizeof (modes_ntsc[0]))
+    return false;
+  return setCustomMode (m_pal ? &modes_pal[mode] : &modes_ntsc[mode]);
+}
+
+//--------------------------------------
+// Move mem bloks using internal blither.  SRC and DST are the byte
+// addresses of the first bytes to move, lines are PITCH bytes apart.
+static void
+moveBlockRaw (uint32_t byteaddress2, uint32_t byteaddress1,
+	      uint16_t pitch, uint8_t width, uint8_t height,
+	      uint8_t dir)
+{
+  static uint8_t last_dir = 0;
+
+  // stay in the first line of the source rectangle
+  // if bit 1 of dir is set
+  uint8_t inc_src = (dir & 2) ? 0 : 1;
+  dir &= 1;
+
+  // If the last move was a reverse one, we have to wait until it's
+  // finished before we can set the new addresses.
+  if (last_dir)
+    while (!blockFinished()) {
+    }
+  SpiRamWriteBMCtrl (BLOCKMVC1, byteaddress2 >> 1, byteaddress1 >> 1,
+		     ((byteaddress1 & 1) << 1) | ((byteaddress2 & 1) << 2)
+		     | dir | lowpass());
+  if (!last_dir)
+    while (!blockFinished()) {
+    }
+  SpiRamWriteBM2Ctrl ((pitch - width) * inc_src, width, height - 1);
+  startBlockMove();
+  last_dir = dir;
+}
+
+static void
+moveBlockAddr (uint32_t src, uint32_t dst, uint16_t pitch,
+	       uint8_t width, uint8_t height, uint8_t dir)
+{
+  if (m_clear_lines)
+    {
+      // Bytes reached by the move, bit 1 of dir moves without skips.
+      uint32_t span = (uint32_t) ((dir & 2) ? width : pitch) * (height - 1)
+	+ width - 1;
+
+      touchRange (src - ((dir & 1) ? span : 0), src + ((dir & 1) ? 0 : span));
+      touchRange (dst - ((dir & 1) ? span : 0), dst + ((dir & 1) ? 0 : span));
+    }
+  moveBlockRaw (src, dst, pitch, width, height, dir);
+}
+
+void
+MoveBlock (uint16_t x_src, uint16_t y_src,
+	   uint16_t x_dst, uint16_t y_dst,
+	   uint8_t width, uint8_t height,
+	   uint8_t dir)
+{
+  if (m_dirty_on)
+    {
+      // Moves start at (X_DST, Y_DST), reverse ones run backwards
+      // from there.  Without skips they run on along the lines.
+      uint32_t len = (uint32_t) width * height;
+
+      if (!(dir & 2))
+	damage ((dir & 1) ? x_dst - width + 1 : x_dst,
+		(dir & 1) ? y_dst - height + 1 : y_dst, width, height);
+      else if (!(dir & 1) && x_dst + len <= m_draw_width)
+	damage (x_dst, y_dst, len, 1);
+      else if (!(dir & 1))
+	damage (0, y_dst, m_draw_width,
+		(x_dst + len + m_pitch - 1) / m_pitch);
+      else if (len <= (uint32_t) x_dst + 1)
+	damage (x_dst + 1 - len, y_dst, len, 1);
+      else
+	{
+	  uint32_t back = (len - x_dst - 1 + m_pitch - 1) / m_pitch;
+	  uint16_t top = back < y_dst ? y_dst - back : 0;
+
+	  damage (0, top, m_draw_width, y_dst - top + 1);
+	}
+    }
+  moveBlockAddr (pixelAddr(x_src, y_src), pixelAddr(x_dst, y_dst),
+		 m_pitch, width, height, dir);
+}
+
+void
+blitRect (uint16_t x_src, uint16_t y_src,
+	  uint16_t x_dst, uint16_t y_dst,
+	  uint8_t width, uint8_t height)
+{
+  if ((y_dst > y_src && y_dst < y_src + height) ||
+      (y_src == y_dst && x_dst > x_src && x_dst < x_src + width))
+    MoveBlock(x_src + width - 1, y_src + height - 1,
+	      x_dst + width - 1, y_dst + height - 1,
+	      width, height, 1);
+  else
+    MoveBlock(x_src, y_src, x_dst, y_dst, width, height, 0);
+}
+
+void
+fillRectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
+	       uint8_t color)
+{
+  const int seg_width = 8;
+  int width = x2 - x1;
+  const int height = y2 - y1;
+  const int width_segs = width / seg_width;
+
+  damage (x1, y1, width, height);
+  // fill top pixels with background
+  while (!blockFinished()) {}
+  // line of two chars then duplicate with blitter, or all of it if
+  // that is not wider
+  int preset = (width_segs > 2) ? 2 * seg_width : width;
+
+  drawHSpan (x1, y1, preset, color);
+
+  // Apparently source and destination address have to be
+  // at least 4 bytes apart. Alignment is not an issue.
+  if (width_segs > 2)
+    {
+      int adjust = width - width_segs * seg_width;
+      int length = width_segs - ((adjust) ? 1 : 2);
+      int target = x1 + seg_width + ((adjust) ? adjust : seg_width);
+
+      // special mode: skip disabled
+      MoveBlock (x1, y1, target, y1, seg_width, length, 2);
+    }
+
+  // duplicate top line
+  while (width >= 256)
+    {
+      MoveBlock(x1, y1, x1, y1 + 1, 240, height - 1, 0);
+      x1 += 240;       // we can do 255 but we need
+      width -= 240;    // at least 5 for the tail below
+    }
+  MoveBlock(x1, y1, x1, y1 + 1, width, height - 1, 0);
+}
+
+/* Copy a WIDTH x HEIGHT rectangle between surfaces with the block
+   mover.  The mover uses one skip value for source and destination,
+   surfaces of different pitch are therefore copied one line per
+   move.  */
+
+void
+blitSurface (const struct surface_t *src, uint16_t x_src, uint16_t y_src,
+	     const struct surface_t *dst, uint16_t x_dst, uint16_t y_dst,
+	     uint8_t width, uint8_t height)
+{
+  uint32_t from = src->base + (uint32_t) src->pitch * y_src + x_src;
+  uint32_t to = dst->base + (uint32_t) dst->pitch * y_dst + x_dst;
+  uint8_t i;
+
+  if (width == 0 || height == 0)
+    return;
+
+  if (src->pitch == dst->pitch)
+    {
+      uint32_t last = (uint32_t) src->pitch * (height - 1) + width - 1;
+
+      // Overlapping areas further up in memory are moved backwards.
+      if (to > from && to <= from + last)
+	moveBlockAddr (from + last, to + last, src->pitch, width, height, 1);
+      else
+	moveBlockAddr (from, to, src->pitch, width, height, 0);
+      return;
+    }
+
+  for (i = 0; i < height; i++)
+    moveBlockAddr (from + (uint32_t) src->pitch * i,
+		   to + (uint32_t) dst->pitch * i, width, width, 1, 0);
+}
+
+/* Draw LEN pixels of COLOR from (X, Y) to the right, or down if
+   VERTICAL, clipped to the draw surface.  */
+
+static void
+clipSpan (int16_t x, int16_t y, int32_t len, bool vertical, uint8_t color)
+{
+  int16_t *along = vertical ? &y : &x;
+  int16_t across = vertical ? x : y;
+  uint16_t limit = vertical ? m_draw_height : m_draw_width;
+
+  if (across < 0 || across >= (vertical ? m_draw_width : m_draw_height))
+    return;
+  if (*along < 0)
+    {
+      len += *along;
+      *along = 0;
+    }
+  if (len > limit - *along)
+    len = limit - *along;
+  if (len <= 0)
+    return;
+  if (vertical)
+    drawVSpan (x, y, len, color);
+  else
+    drawHSpan (x, y, len, color);
+}
+
+/* Fill W x H pixels from (X, Y) on, clipped to the draw surface.  Big
+   enough blocks are filled by the block mover, see fillRectangle,
+   others one burst per line.  */
+
+static void
+fillBlock (int16_t x, int16_t y, int32_t w, int32_t h, uint8_t color)
+{
+  if (x < 0)
+    {
+      w += x;
+      x = 0;
+    }
+  if (y < 0)
+    {
+      h += y;
+      y = 0;
+    }
+  if (w > m_draw_width - x)
+    w = m_draw_width - x;
+  if (h > m_draw_height - y)
+    h = m_draw_height - y;
+  if (w <= 0 || h <= 0)
+    return;
+
+  if (w < FILL_MOVE_MIN_WIDTH || h < FILL_MOVE_MIN_LINES)
+    {
+      while (h--)
+	drawHSpan (x, y++, w, color);
+      return;
+    }
+  // fillRectangle moves at most 256 lines, and at least 2.
+  while (h)
+    {
+      uint16_t n = h > 256 ? 255 : h;
+
+      fillRectangle (x, y, x + w, y + n, color);
+      y += n;
+      h -= n;
+    }
+}
+
+/* Draw the pixels collected so far as one span.  */
+
+static void
+runFlush (void)
+{
+  if (!m_run_open)
+    return;
+  m_run_open = false;
+  if (m_run_y0 == m_run_y1)
+    clipSpan (m_run_x0, m_run_y0, m_run_x1 - m_run_x0 + 1, false,
+	      m_run_color);
+  else
+    clipSpan (m_run_x0, m_run_y0, m_run_y1 - m_run_y0 + 1, true,
+	      m_run_color);
+}
+
+/* Add pixel (X, Y) to the run, or start a new one if it does not
+   continue it.  */
+
+static void
+runPixel (int16_t x, int16_t y)
+{
+  if (m_run_open)
+    {
+      if (x >= m_run_x0 && x <= m_run_x1 && y >= m_run_y0 && y <= m_run_y1)
+	return;
+      if (m_run_y0 == m_run_y1 && y == m_run_y0)
+	{
+	  if (x == m_run_x0 - 1)
+	    {
+	      m_run_x0 = x;
+	      return;
+	    }
+	  if (x == m_run_x1 + 1)
+	    {
+	      m_run_x1 = x;
+	      return;
+	    }
+	}
+      if (m_run_x0 == m_run_x1 && x == m_run_x0)
+	{
+	  if (y == m_run_y0 - 1)
+	    {
+	      m_run_y0 = y;
+	      return;
+	    }
+	  if (y == m_run_y1 + 1)
+	    {
+	      m_run_y1 = y;
+	      return;
+	    }
+	}
+      runFlush ();
+    }
+  m_run_x0 = m_run_x1 = x;
+  m_run_y0 = m_run_y1 = y;
+  m_run_open = true;
+}
+
+/* Draw a line from (X0, Y0) to (X1, Y1), both ends included, clipped
+   to the draw surface.  The Bresenham steps are drawn as horizontal
+   runs if the line is flat and vertical runs if it is steep.  */
+
+void
+drawLine (int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint8_t color)
+{
+  int32_t dx = x1 > x0 ? x1 - x0 : x0 - x1;
+  int32_t dy = y1 > y0 ? y0 - y1 : y1 - y0;
+  int8_t sx = x0 < x1 ? 1 : -1;
+  int8_t sy = y0 < y1 ? 1 : -1;
+  int32_t err = dx + dy;
+
+  m_run_color = color;
+  for (;;)
+    {
+      int32_t e2 = 2 * err;
+
+      runPixel (x0, y0);
+      if (x0 == x1 && y0 == y1)
+	break;
+      if (e2 >= dy)
+	{
+	  err += dy;
+	  x0 += sx;
+	}
+      if (e2 <= dx)
+	{
+	  err += dx;
+	  y0 += sy;
+	}
+    }
+  runFlush ();
+}
+
+/* True if (X, Y), relative to the centre, is on the arc set up by
+   drawArc.  */
+
+static bool
+arcHas (int16_t x, int16_t y)
+{
+  int32_t from = (int32_t) m_arc_sx * y - (int32_t) m_arc_sy * x;
+  int32_t to = (int32_t) x * m_arc_ey - (int32_t) y * m_arc_ex;
+
+  if (m_arc_wide)
+    return from >= 0 || to >= 0;
+  return from >= 0 && to >= 0;
+}
+
+/* Outline of a circle of radius R around (CX, CY) by the midpoint
+   algorithm, one octant after the other so that each is drawn in
+   runs: horizontal at the top and bottom, vertical at the sides.
+   Only the pixels on the drawArc arc if ARC.  */
+
+static void
+circleRuns (int16_t cx, int16_t cy, uint16_t r, bool arc)
+{
+  uint8_t oct;
+
+  for (oct = 0; oct < 8; oct++)
+    {
+      int16_t x = 0, y = r;
+      int32_t d = 1 - (int32_t) r;
+
+      while (x <= y)
+	{
+	  int16_t px = (oct & 1) ? y : x;
+	  int16_t py = (oct & 1) ? x : y;
+
+	  if (oct & 2)
+	    px = -px;
+	  if (oct & 4)
+	    py = -py;
+	  if (!arc || arcHas (px, py))
+	    runPixel (cx + px, cy + py);
+	  else
+	    runFlush ();
+	  if (d < 0)
+	    d += 2 * x + 3;
+	  else
+	    {
+	      d += 2 * (x - y) + 5;
+	      y--;
+	    }
+	  x++;
+	}
+      runFlush ();
+    }
+}
+
+void
+drawCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color)
+{
+  m_run_color = color;
+  circleRuns (cx, cy, r, false);
+}
+
+/* Draw the part of the circle of radius R around (CX, CY) from angle
+   START clockwise to END, in degrees clockwise from 3 o'clock.  A
+   sweep of 360 degrees or more is the whole circle.  */
+
+void
+drawArc (int16_t cx, int16_t cy, uint16_t r, int16_t start, int16_t end,
+	 uint8_t color)
+{
+  int16_t sweep = end - start;
+
+  if (sweep >= 360 || sweep <= -360)
+    {
+      drawCircle (cx, cy, r, color);
+      return;
     }
-  }
+  sweep = (sweep + 360) % 360;
+  if (sweep == 0)
+    return;
+  m_arc_sx = cos (start * M_PI / 180) * 1024;
+  m_arc_sy = sin (start * M_PI / 180) * 1024;
+  m_arc_ex = cos (end * M_PI / 180) * 1024;
+  m_arc_ey = sin (end * M_PI / 180) * 1024;
+  m_arc_wide = sweep > 180;
+  m_run_color = color;
+  circleRuns (cx, cy, r, true);
+}
 
-  // 13. Set pic line indexes to point to protoline 0 and their
-  // individual picture line.
-  for (i = 0; i < ENDLINE - STARTLINE; i++) {
-    SetPicIndex(i + STARTLINE, piclineByteAddress(i), 0);
-    // All lines use picture line 0
-    // SetPicIndex(i+STARTLINE, PICLINE_BYTE_ADDRESS(0),0);
-    if (m_interlace) {
-      // In interlaced case in both fields the same area is picture
-      // box area.
-      // XXX: In PAL example, it says "TOTAL_LINES/2" instead of FIELD1START
-      SetPicIndex (i + STARTLINE + FIELD1START, piclineByteAddress(i),  0);
+/* Line CY + DY of fillCircle, HW pixels to either side of CX.  Lines
+   crossing the square from -S to S are only drawn outside of it.  */
+
+static void
+circleLine (int16_t cx, int16_t cy, int16_t dy, int16_t hw, int16_t s,
+	    uint8_t color)
+{
+  if (s >= 0 && dy >= -s && dy <= s)
+    {
+      if (hw > s)
+	{
+	  clipSpan (cx - hw, cy + dy, hw - s, false, color);
+	  clipSpan (cx + s + 1, cy + dy, hw - s, false, color);
+	}
+      return;
     }
-  }
+  clipSpan (cx - hw, cy + dy, 2 * hw + 1, false, color);
+}
 
-  // 14. Set number of lines, length of pixel and enable video
-  // generation
-  // The line count is TOTAL_LINES - 1 in the example, but the only
-  // value that doesn't produce a crap picture is 263 (even interlaced,
-  // PAL: 314), on both CRT and LCD displays, so we hard-code it here.
+/* Fill a circle of radius R around (CX, CY), the same pixels as
+   drawCircle and those inside.  The square inscribed into a big
+   enough circle is filled by the block mover, the rest one burst per
+   line and side.  */
 
-  // XXX: PAL on Daewoo LCD TV, screen mode 1: 314 has no color noise,
-  //	but shifts one pixel up or down, depending on screen content;
-  //	"standard" 313 has color noise, but remains in place.
-  //	Does not seem to happen in other modes, may be a TV quirk.
+void
+fillCircle (int16_t cx, int16_t cy, uint16_t r, uint8_t color)
+{
+  int16_t x = 0, y = r;
+  int32_t d = 1 - (int32_t) r;
+  int16_t s = -1;
 
-  int total_lines;
-  if (m_pal)
-    total_lines = 314;
-  else
-    total_lines = 263;
-  if (m_interlace)
-    total_lines *= 2;
+  // Half the side of the inscribed square, 2 * s * s <= r * r.
+  if (r >= FILL_MOVE_MIN_WIDTH / 2)
+    {
+      s = r * 46341L >> 16;
+      while (2L * (s + 1) * (s + 1) <= (int32_t) r * r)
+	s++;
+      fillBlock (cx - s, cy - s, 2 * s + 1, 2 * s + 1, color);
+    }
 
-  SpiRamWriteRegister (VDCTRL2,
-		       (VDCTRL2_LINECOUNT * (total_lines + m_line_adjust))
-		       | (VDCTRL2_PIXEL_WIDTH * (PLLCLKS_PER_PIXEL - 1))
-		       | (m_pal ? VDCTRL2_PAL : 0)
-		       | (VDCTRL2_ENABLE_VIDEO));
+  // Each line once: those X down get Y wide, those Y down get X wide
+  // when Y is about to change.
+  while (x <= y)
+    {
+      circleLine (cx, cy, x, y, s, color);
+      if (x)
+	circleLine (cx, cy, -x, y, s, color);
+      if (d < 0)
+	d += 2 * x + 3;
+      else
+	{
+	  if (x != y)
+	    {
+	      circleLine (cx, cy, y, x, s, color);
+	      circleLine (cx, cy, -y, x, s, color);
+	    }
+	  d += 2 * (x - y) + 5;
+	  y--;
+	}
+      x++;
+    }
+}
+
+/* Draw the blocks of fillPolygon, N at B, that did not get another
+   line, and count the line of those that did.  Returns how many go
+   on.  */
+
+static uint8_t
+polyFlush (struct poly_block_t *b, uint8_t n, uint8_t color)
+{
+  uint8_t i, kept = 0;
+
+  for (i = 0; i < n; i++)
+    if (b[i].next)
+      {
+	b[i].next = false;
+	b[i].h++;
+	b[kept++] = b[i];
+      }
+    else
+      fillBlock (b[i].x0, b[i].y, b[i].x1 - b[i].x0, b[i].h, color);
+  return kept;
 }
 
+/* Fill the polygon with the N corners at POINTS, x and y of each in
+   turn, by the even-odd rule; it may be concave or cross itself.  A
+   pixel is filled if its centre is inside, so polygons that share an
+   edge do not overlap.  A span that repeats on the following lines
+   is filled as one block, by the block mover if it is big enough,
+   other spans with one burst each.  */
+
 void
-videoBegin (bool interlace, bool lowpass, uint8_t system)
+fillPolygon (const int16_t *points, uint8_t n, uint8_t color)
 {
-  m_vsync_enabled = false;
-  m_interlace = interlace;
-  m_lowpass = lowpass;
-  m_pal = system != 0;
-  m_line_adjust = 0;
-  m_gpio_state = 0xf;
+  struct poly_block_t block[MAX_POLY_CROSSINGS];
+  int16_t cross[MAX_POLY_CROSSINGS];
+  uint8_t blocks = 0;
+  int16_t top, bottom, y;
+  uint8_t i, j, k;
+
+  if (n < 3)
+    return;
+  top = bottom = points[1];
+  for (i = 1; i < n; i++)
+    {
+      if (points[2 * i + 1] < top)
+	top = points[2 * i + 1];
+      if (points[2 * i + 1] > bottom)
+	bottom = points[2 * i + 1];
+    }
+  if (top < 0)
+    top = 0;
+  if (bottom > (int16_t) m_draw_height)
+    bottom = m_draw_height;
 
-  SpiRamWriteRegister (WRITE_GPIO_CTRL, m_gpio_state);
+  for (y = top; y < bottom; y++)
+    {
+      uint8_t count = 0;
+
+      // Where the edges cross the middle of line Y, sorted.
+      for (i = 0; i < n && count < MAX_POLY_CROSSINGS; i++)
+	{
+	  const int16_t *a = &points[2 * i];
+	  const int16_t *b = &points[2 * ((i + 1) % n)];
+	  int32_t dy, num;
+	  int16_t x;
+
+	  if (a[1] > b[1])
+	    {
+	      const int16_t *t = a;
+	      a = b;
+	      b = t;
+	    }
+	  if (y < a[1] || y >= b[1])
+	    continue;
+	  // The first pixel with its centre right of the crossing.
+	  dy = b[1] - a[1];
+	  num = 2L * a[0] * dy + (2L * (y - a[1]) + 1) * (b[0] - a[0]) - dy;
+	  x = num >= 0 ? (num + 2 * dy - 1) / (2 * dy) : -(-num / (2 * dy));
+	  for (k = count++; k > 0 && cross[k - 1] > x; k--)
+	    cross[k] = cross[k - 1];
+	  cross[k] = x;
+	}
+
+      // A span goes on a block that had the same span on the line
+      // above, or starts a new one.
+      for (k = 0; k + 1 < count; k += 2)
+	{
+	  int16_t x0 = cross[k] < 0 ? 0 : cross[k];
+	  int16_t x1 = cross[k + 1] > (int16_t) m_draw_width
+	    ? (int16_t) m_draw_width : cross[k + 1];
+
+	  if (x0 >= x1)
+	    continue;
+	  for (j = 0; j < blocks; j++)
+	    if (block[j].x0 == x0 && block[j].x1 == x1 && !block[j].next)
+	      break;
+	  if (j == blocks)
+	    {
+	      block[blocks].x0 = x0;
+	      block[blocks].x1 = x1;
+	      block[blocks].y = y;
+	      block[blocks++].h = 0;
+	    }
+	  block[j].next = true;
+	}
+      blocks = polyFlush (block, blocks, color);
+    }
+  polyFlush (block, blocks, color);
+}
 
-  setMode(1);
+/* Set up the glyph cache for glyphs of WIDTH x HEIGHT pixels with
+   room for up to SLOTS of them, as many as fit into the free SRAM.
+   True if there is room for at least one atlas row; a cache of the
+   same glyph size is kept as it is.  Glyphs are drawn from the cache
+   with drawGlyph, setMode releases it.  */
+
+bool
+glyphCacheBegin (uint8_t width, uint8_t height, uint16_t slots)
+{
+  uint16_t pitch = m_picbuf[0].surf.pitch;
+  uint16_t rows;
+
+  if (m_glyph_atlas && width == m_glyph_w && height == m_glyph_h
+      && pitch == m_glyph_pitch)
+    return true;
+  glyphCacheEnd ();
+  if (width == 0 || width > GLYPH_MAX_WIDTH || height == 0)
+    return false;
+  if (slots > MAX_GLYPH_SLOTS)
+    slots = MAX_GLYPH_SLOTS;
+
+  m_glyph_cols = pitch / width;
+  for (rows = (slots + m_glyph_cols - 1) / m_glyph_cols; rows; rows--)
+    {
+      m_glyph_atlas = sramAlloc ((uint32_t) pitch * height * rows);
+      if (m_glyph_atlas)
+	break;
+    }
+  if (!m_glyph_atlas)
+    return false;
+
+  if (slots > rows * m_glyph_cols)
+    slots = rows * m_glyph_cols;
+  m_glyph_slot = (struct glyph_slot_t *)
+    malloc (slots * sizeof (*m_glyph_slot)
+	    + (1 << GLYPH_HASH_BITS) * sizeof (*m_glyph_bucket));
+  if (!m_glyph_slot)
+    {
+      sramFree (m_glyph_atlas);
+      m_glyph_atlas = 0;
+      return false;
+    }
+  m_glyph_bucket = (uint16_t *) (m_glyph_slot + slots);
+  m_glyph_slots = slots;
+  m_glyph_pitch = pitch;
+  m_glyph_w = width;
+  m_glyph_h = height;
+  glyphCacheClear ();
+  return true;
 }
 
 void
-videoReset (void)
+glyphCacheEnd (void)
 {
-  setColorSpace(1);
+  if (m_glyph_atlas)
+    sramFree (m_glyph_atlas);
+  m_glyph_atlas = 0;
+  m_glyph_slots = 0;
+  free (m_glyph_slot);
+  m_glyph_slot = NULL;
 }
 
-void setSyncLine (uint16_t line)
+/* Forget all glyphs, for example when the font changed.  */
+
+void
+glyphCacheClear (void)
 {
-  if (line == 0) {
-    m_vsync_enabled = false;
-  } else {
-    m_sync_line = line;
-    m_vsync_enabled = true;
-  }
+  uint16_t i;
+
+  if (!m_glyph_slot)
+    return;
+  for (i = 0; i < m_glyph_slots; i++)
+    m_glyph_slot[i].used = 0;
+  for (i = 0; i < (1 << GLYPH_HASH_BITS); i++)
+    m_glyph_bucket[i] = GLYPH_NONE;
+  m_glyph_clock = 0;
 }
 
-uint16_t currentLine (void)
+static inline uint8_t
+glyphHash (uint32_t key)
 {
-  uint16_t cl = SpiRamReadRegister(CURLINE) & 0xfff;
-  if (m_interlace && cl >= 262)
-    cl -= 262;
-  return cl;
+  return (uint32_t) (key * 2654435761UL) >> (32 - GLYPH_HASH_BITS);
 }
 
-bool
-setMode (uint8_t mode)
+static void
+glyphUnlink (uint16_t slot)
 {
-  setSyncLine(0);
+  uint16_t *p = &m_glyph_bucket[glyphHash (m_glyph_slot[slot].key)];
 
-  m_current_mode = m_pal ? &modes_pal[mode] : &modes_ntsc[mode];
-  m_first_line_addr = PICLINE_BYTE_ADDRESS(0);
-  m_pitch = PICLINE_BYTE_ADDRESS(1) - m_first_line_addr;
+  while (*p != slot)
+    p = &m_glyph_slot[*p].next;
+  *p = m_glyph_slot[slot].next;
+  m_glyph_slot[slot].used = 0;
+}
 
-  videoInit(0);
+/* Forget GLYPH in all colours, its bits have changed.  */
 
-  // Start the new frame at the end of the visible screen plus a little extra.
-  // Used to be two-thirds down the screen, but that caused more flicker when
-  // the rendering load changes drastically.
-  setSyncLine(m_current_mode->y + m_current_mode->top + 16);
+void
+glyphCacheForget (uint16_t glyph)
+{
+  uint16_t i;
 
-  // Sony KX-14CP1 and possibly other displays freak out if we start drawing
-  // stuff before they had a chance to synchronize with the new mode, so we
-  // wait a few frames.
-  delay(160);
+  for (i = 0; i < m_glyph_slots; i++)
+    if (m_glyph_slot[i].used && m_glyph_slot[i].key >> 16 == glyph)
+      glyphUnlink (i);
+}
 
-  return true;
+static inline uint32_t
+glyphAddr (uint16_t slot)
+{
+  return m_glyph_atlas
+    + (uint32_t) m_glyph_pitch * m_glyph_h * (slot / m_glyph_cols)
+    + (uint32_t) m_glyph_w * (slot % m_glyph_cols);
 }
 
-//--------------------------------------
-// Move mem bloks using internal blither.
+/* The slot holding KEY, rendered from BITS into the least recently
+   drawn slot if it is not cached.  */
+
+static uint16_t
+glyphSlot (uint32_t key, const uint8_t *bits)
+{
+  uint8_t hash = glyphHash (key);
+  uint32_t addr;
+  uint16_t slot, i;
+  uint8_t colors[2] = { key >> 8, key };
+  uint8_t buf[GLYPH_MAX_WIDTH];
+
+  for (slot = m_glyph_bucket[hash]; slot != GLYPH_NONE;
+       slot = m_glyph_slot[slot].next)
+    if (m_glyph_slot[slot].key == key)
+      return slot;
+
+  slot = 0;
+  for (i = 1; i < m_glyph_slots && m_glyph_slot[slot].used; i++)
+    if (m_glyph_slot[i].used < m_glyph_slot[slot].used)
+      slot = i;
+  if (m_glyph_slot[slot].used)
+    glyphUnlink (slot);
+  m_glyph_slot[slot].key = key;
+  m_glyph_slot[slot].next = m_glyph_bucket[hash];
+  m_glyph_bucket[hash] = slot;
+
+  // A move still running may read the slot.
+  while (!blockFinished()) {
+  }
+  addr = glyphAddr (slot);
+  for (i = 0; i < m_glyph_h; i++)
+    {
+      uint8_t j;
+
+      conv1bpp (buf, bits + i, 0, m_glyph_w, colors);
+      SpiRamWriteBegin (addr);
+      for (j = 0; j < m_glyph_w; j++)
+	spi_transfer (buf[j]);
+      SpiRamWriteEnd ();
+      addr += m_glyph_pitch;
+    }
+  return slot;
+}
+
+/* Draw GLYPH with its top left corner at (X, Y) of the draw surface,
+   clipped to it, set bits in FG and clear ones in BG.  BITS are the
+   glyph lines, one byte each with the most significant bit first.
+   The first time a glyph is drawn in these colours it is rendered
+   into the glyph cache, from then on it is a single block move.
+   Without a cache of the glyph size the bits are drawn directly.  */
+
 void
-MoveBlock (uint16_t x_src, uint16_t y_src,
-	   uint16_t x_dst, uint16_t y_dst,
-	   uint8_t width, uint8_t height,
-	   uint8_t dir)
+drawGlyph (uint16_t x, uint16_t y, uint16_t glyph, const uint8_t *bits,
+	   uint8_t w, uint8_t h, uint8_t fg, uint8_t bg)
 {
-  static uint8_t last_dir = 0;
-  uint32_t byteaddress1 = pixelAddr(x_dst, y_dst);
-  uint32_t byteaddress2 = pixelAddr(x_src, y_src);
+  uint32_t src, dst;
+  uint16_t slot;
+  uint8_t i;
 
-  // stay in the first line of the source rectangle
-  // if bit 1 of dir is set
-  uint8_t inc_src = (dir & 2) ? 0 : 1;
-  dir &= 1;
+  if (!m_glyph_atlas || w != m_glyph_w || h != m_glyph_h)
+    {
+      drawBitmap1 (x, y, w, h, bits, 1, fg, bg);
+      return;
+    }
+  if (x >= m_draw_width || y >= m_draw_height)
+    return;
+  if (w > m_draw_width - x)
+    w = m_draw_width - x;
+  if (h > m_draw_height - y)
+    h = m_draw_height - y;
+
+  damage (x, y, w, h);
+  slot = glyphSlot ((uint32_t) glyph << 16 | fg << 8 | bg, bits);
+  m_glyph_slot[slot].used = ++m_glyph_clock;
+  src = glyphAddr (slot);
+  dst = pixelAddr (x, y);
+  if (m_pitch == m_glyph_pitch)
+    {
+      moveBlockAddr (src, dst, m_pitch, w, h, 0);
+      return;
+    }
+  for (i = 0; i < h; i++)
+    moveBlockAddr (src + (uint32_t) m_glyph_pitch * i,
+		   dst + (uint32_t) m_pitch * i, w, w, 1, 0);
+}
 
-  // If the last move was a reverse one, we have to wait until it's
-  // finished before we can set the new addresses.
-  if (last_dir)
-    while (!blockFinished()) {
+/* Time the transactions the repaint cost model weighs, on scratch
+   SRAM: single byte writes against one burst of as many bytes, and
+   single byte moves against one long move.  The defaults stay if
+   there is no SRAM to spare or micros() is too coarse to tell.  */
+
+static uint16_t
+dirtyByteNs (uint32_t ns)
+{
+  return ns < DIRTY_BYTE_NS_MAX ? ns : DIRTY_BYTE_NS_MAX;
+}
+
+static void
+dirtyCalibrate (void)
+{
+  uint32_t scratch = sramAlloc (2 * DIRTY_CAL_BYTES);
+  uint32_t t, single, burst;
+  uint8_t i;
+
+  if (scratch == 0)
+    return;
+  while (!blockFinished()) {}
+
+  // N single writes are N overheads and N bytes, a burst one and N.
+  t = micros ();
+  for (i = 0; i < DIRTY_CAL_BYTES; i++)
+    SpiRamWriteByte (scratch + i, 0);
+  single = micros () - t;
+  t = micros ();
+  SpiRamWriteBegin (scratch);
+  for (i = 0; i < DIRTY_CAL_BYTES; i++)
+    spi_transfer (0);
+  SpiRamWriteEnd ();
+  burst = micros () - t;
+  if (single > burst)
+    {
+      m_dirty_write_ns = (single - burst) * 1000 / (DIRTY_CAL_BYTES - 1);
+      if (burst * 1000 > m_dirty_write_ns)
+	m_dirty_byte_ns = dirtyByteNs ((burst * 1000 - m_dirty_write_ns)
+				       / DIRTY_CAL_BYTES);
     }
-  SpiRamWriteBMCtrl (BLOCKMVC1, byteaddress2 >> 1, byteaddress1 >> 1,
-		     ((byteaddress1 & 1) << 1) | ((byteaddress2 & 1) << 2)
-		     | dir | lowpass());
-  if (!last_dir)
-    while (!blockFinished()) {
+
+  t = micros ();
+  for (i = 0; i < DIRTY_CAL_MOVES; i++)
+    moveBlockRaw (scratch, scratch + DIRTY_CAL_BYTES, DIRTY_CAL_BYTES,
+		  1, 1, 0);
+  while (!blockFinished()) {}
+  single = micros () - t;
+  t = micros ();
+  moveBlockRaw (scratch, scratch + DIRTY_CAL_BYTES, DIRTY_CAL_BYTES,
+		DIRTY_CAL_BYTES, 1, 0);
+  while (!blockFinished()) {}
+  burst = micros () - t;
+  if (single > 0)
+    {
+      m_dirty_move_ns = single * 1000 / DIRTY_CAL_MOVES;
+      if (burst * 1000 > m_dirty_move_ns)
+	m_dirty_move_byte_ns = dirtyByteNs ((burst * 1000 - m_dirty_move_ns)
+					    / DIRTY_CAL_BYTES);
     }
-  SpiRamWriteBM2Ctrl ((m_pitch - width) * inc_src, width, height - 1);
-  startBlockMove();
-  last_dir = dir;
+
+  sramFree (scratch);
+  m_dirty_timed = true;
 }
 
-void
-blitRect (uint16_t x_src, uint16_t y_src,
-	  uint16_t x_dst, uint16_t y_dst,
-	  uint8_t width, uint8_t height)
+/* Time it takes to repaint R: one write burst per line or, if the
+   application repaints with block moves and that is cheaper, one move
+   per 255 x 255 pixels.  Sets R->blit accordingly.  A rectangle never
+   costs less than one inside it.  */
+
+static uint32_t
+dirtyCost (struct dirty_rect_t *r)
 {
-  if ((y_dst > y_src && y_dst < y_src + height) ||
-      (y_src == y_dst && x_dst > x_src && x_dst < x_src + width))
-    MoveBlock(x_src + width - 1, y_src + height - 1,
-	      x_dst + width - 1, y_dst + height - 1,
-	      width, height, 1);
-  else
-    MoveBlock(x_src, y_src, x_dst, y_dst, width, height, 0);
+  uint32_t burst = (uint32_t) r->h
+    * (m_dirty_write_ns + (uint32_t) r->w * m_dirty_byte_ns);
+  uint32_t blit;
+
+  r->blit = false;
+  if (!m_dirty_blit)
+    return burst;
+  blit = (uint32_t) ((r->w + 254) / 255) * ((r->h + 254) / 255)
+    * m_dirty_move_ns + (uint32_t) r->w * r->h * m_dirty_move_byte_ns;
+  if (blit >= burst)
+    return burst;
+  r->blit = true;
+  return blit;
+}
+
+/* Bounding box U of A and B.  */
+
+static void
+dirtyBounds (struct dirty_rect_t *u, const struct dirty_rect_t *a,
+	     const struct dirty_rect_t *b)
+{
+  uint16_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+  uint16_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+  u->x = a->x < b->x ? a->x : b->x;
+  u->y = a->y < b->y ? a->y : b->y;
+  u->w = x1 - u->x;
+  u->h = y1 - u->y;
+}
+
+/* Add R to the damaged areas.  Each one that is cheaper to repaint
+   together with R than apart is merged into R, until none is left.
+   If there are LIMIT areas then, R is merged with the one it makes
+   the least more expensive.  */
+
+static void
+dirtyInsert (struct dirty_rect_t *r, uint8_t limit)
+{
+  struct dirty_rect_t u;
+  uint32_t cost = dirtyCost (r);
+  uint32_t ucost, grow, least;
+  uint8_t i, pick;
+
+  for (;;)
+    {
+      least = 0xffffffff;
+      pick = 0;
+      for (i = 0; i < m_dirty_count; i++)
+	{
+	  dirtyBounds (&u, &m_dirty[i], r);
+	  ucost = dirtyCost (&u);
+	  grow = ucost - m_dirty_cost[i];
+	  if (grow <= cost)
+	    break;
+	  if (grow < least)
+	    {
+	      least = grow;
+	      pick = i;
+	    }
+	}
+      if (i == m_dirty_count)
+	{
+	  if (m_dirty_count < limit)
+	    break;
+	  i = pick;
+	  dirtyBounds (&u, &m_dirty[i], r);
+	  ucost = dirtyCost (&u);
+	}
+      *r = u;
+      cost = ucost;
+      m_dirty[i] = m_dirty[--m_dirty_count];
+      m_dirty_cost[i] = m_dirty_cost[m_dirty_count];
+    }
+  m_dirty[m_dirty_count] = *r;
+  m_dirty_cost[m_dirty_count++] = cost;
 }
 
+/* Track the areas drawing damages, to repaint only those.  Drawing to
+   the draw surface adds the area it draws to, in draw surface
+   coordinates.  blitSurface, which is given its surfaces, is not
+   tracked and can repaint from a copy.  BLIT says if the application
+   can repaint with block moves, else only write bursts are costed.
+   The first call times the SPI transactions the costs are made of.  */
+
 void
-fillRectangle (uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2,
-	       uint8_t color)
+dirtyBegin (bool blit)
 {
-  const int seg_width = 8;
-  int width = x2 - x1;
-  const int height = y2 - y1;
-  const int width_segs = width / seg_width;
+  if (!m_dirty_timed)
+    dirtyCalibrate ();
+  m_dirty_blit = blit;
+  m_dirty_count = 0;
+  m_dirty_on = true;
+}
 
-  // fill top pixels with background
-  while (!blockFinished()) {}
-  // line at most two chars then duplicate with blitter
-  int preset = seg_width + ((width_segs == 1) ? 0 : seg_width);
+void
+dirtyEnd (void)
+{
+  m_dirty_on = false;
+  m_dirty_count = 0;
+}
 
-  //   gfx.drawLine(x1, y1, x1 + preset - 1, y1, color);
-  for (int i = x1; i <= (x1 + preset - 1); i++)
-    setPixelYuv (i, y1, color);
+/* Add the W x H pixels from (X, Y) on to the damaged areas, clipped to
+   the draw surface.  For damage that was not drawn through the driver,
+   such as to a buffer that is shown later.  */
 
-  // Apparently source and destination address have to be
-  // at least 4 bytes apart. Alignment is not an issue.
-  if (width_segs > 2)
+void
+dirtyAdd (uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+  struct dirty_rect_t r;
+  uint8_t i;
+
+  if (x >= m_draw_width || y >= m_draw_height || w == 0 || h == 0)
+    return;
+  if (w > m_draw_width - x)
+    w = m_draw_width - x;
+  if (h > m_draw_height - y)
+    h = m_draw_height - y;
+
+  // Most drawing lands in an area that is damaged already.
+  for (i = 0; i < m_dirty_count; i++)
     {
-      int adjust = width - width_segs * seg_width;
-      int length = width_segs - ((adjust) ? 1 : 2);
-      int target = x1 + seg_width + ((adjust) ? adjust : seg_width);
+      const struct dirty_rect_t *d = &m_dirty[i];
 
-      // special mode: skip disabled
-      MoveBlock (x1, y1, target, y1, seg_width, length, 2);
+      if (x >= d->x && y >= d->y && x + w <= d->x + d->w
+	  && y + h <= d->y + d->h)
+	return;
     }
 
-  // duplicate top line
-  while (width >= 256)
+  r.x = x;
+  r.y = y;
+  r.w = w;
+  r.h = h;
+  dirtyInsert (&r, MAX_DIRTY_RECTS);
+}
+
+/* Store the damaged areas at RECTS, at most MAX of them, and return
+   how many there are.  Areas are merged further as long as there are
+   more than MAX.  They stay damaged until dirtyClear, which is called
+   once they are repainted; repainting through the tracked drawing
+   functions damages them again.  */
+
+uint8_t
+dirtyRects (struct dirty_rect_t *rects, uint8_t max)
+{
+  struct dirty_rect_t r;
+
+  if (max == 0)
+    return 0;
+  while (m_dirty_count > max)
     {
-      MoveBlock(x1, y1, x1, y1 + 1, 240, height - 1, 0);
-      x1 += 240;       // we can do 255 but we need
-      width -= 240;    // at least 5 for the tail below
+      r = m_dirty[--m_dirty_count];
+      dirtyInsert (&r, max);
     }
-  MoveBlock(x1, y1, x1, y1 + 1, width, height - 1, 0);
+  memcpy (rects, m_dirty, m_dirty_count * sizeof (*rects));
+  return m_dirty_count;
+}
+
+void
+dirtyClear (void)
+{
+  m_dirty_count = 0;
 }
 
 // -----------------------------------------------
 // Fill memory locations of display data with colour, 0x00 would equal black
 
+/* Issue the next block move of the lazy clear: line 0 of the frame
+   buffer is duplicated downwards, up to 240 columns and 255 lines per
+   move.  */
+
+static void
+clearStep (void)
+{
+  const struct surface_t *fb = &m_picbuf[0].surf;
+  uint16_t w = fb->width - m_clear_x;
+  uint16_t h = fb->height - 1 - m_clear_y;
+  uint32_t src = fb->base + (uint32_t) fb->pitch * m_clear_y + m_clear_x;
+
+  if (w > 240)
+    w = 240;
+  if (h > 255)
+    h = 255;
+  moveBlockRaw (src, src + fb->pitch, fb->pitch, w, h, 0);
+
+  m_clear_y += h;
+  if (m_clear_y >= fb->height - 1)
+    {
+      m_clear_y = 0;
+      m_clear_x += w;
+    }
+}
+
+/* Issue all outstanding clear moves and wait for the block mover.  */
+
+static void
+clearFinish (void)
+{
+  while (m_clear_x < m_picbuf[0].surf.width)
+    clearStep ();
+  while (!blockFinished()) {}
+}
+
+/* Point the frame buffer bands at the pre-filled line, or back at the
+   frame buffer, and start the clear moves.  */
+
+static void
+clearIndexOp (uint32_t unused1 ATTRIBUTE_UNUSED,
+	      uint32_t unused2 ATTRIBUTE_UNUSED)
+{
+  writeBufIndex (0);
+  clearScreenPoll ();
+}
+
+/* Frame buffer bytes LO to HI are about to be drawn or read: finish
+   the clear and point the scan lines of their lines back at the frame
+   buffer.  */
+
+static void
+clearTouch (uint32_t lo, uint32_t hi)
+{
+  const struct surface_t *fb = &m_picbuf[0].surf;
+  uint32_t end = fb->base + (uint32_t) fb->pitch * fb->height;
+  uint16_t line, first, last, touched = 0;
+  struct defer_op_t *op;
+
+  if (hi < fb->base || lo >= end)
+    return;
+  if (lo < fb->base)
+    lo = fb->base;
+  if (hi >= end)
+    hi = end - 1;
+
+  clearFinish ();
+  first = (lo - fb->base) / fb->pitch;
+  last = (hi - fb->base) / fb->pitch;
+  for (line = first; line <= last; line++)
+    if (clearPending (line))
+      {
+	m_clear_pending[line >> 3] &= ~(1 << (line & 7));
+	m_clear_lines--;
+	touched++;
+      }
+  if (!touched)
+    return;
+
+  // Rewrite the scan lines of every band showing these lines.  A
+  // queued index write of the same group covers them already, or can
+  // take them on.
+  op = deferTail ();
+  if (op && op->run == clearIndexOp)
+    return;
+  if (op && op->run == writeBufLinesOp)
+    {
+      if (first > op->a)
+	first = op->a;
+      if (last < op->b)
+	last = op->b;
+      op->a = first;
+      op->b = last;
+      op->bytes = (last - first + 1) * 3 * LINEREP + 8;
+      return;
+    }
+  if (!deferred (writeBufLinesOp, first, last,
+		 (last - first + 1) * 3 * LINEREP + 8))
+    writeBufLines (0, first, last);
+}
+
+/* Advance the lazy clear without waiting, returns true once the frame
+   buffer is cleared.  */
+
+bool
+clearScreenPoll (void)
+{
+  if (m_clear_x < m_picbuf[0].surf.width && blockFinished())
+    clearStep ();
+  return m_clear_x >= m_picbuf[0].surf.width && blockFinished();
+}
+
+/* Finish the lazy clear and show the frame buffer on all lines.  */
+
+void
+clearScreenFlush (void)
+{
+  if (!m_clear_lines)
+    return;
+  clearFinish ();
+  memset (m_clear_pending, 0, sizeof (m_clear_pending));
+  m_clear_lines = 0;
+  if (!deferred (writeBufIndexOp, 0, 0, indexBytes ()))
+    writeBufIndex (0);
+}
+
+/* Clearing the frame buffer points all its scan lines at one line
+   filled with COLOR, the screen is clear after one index burst.  The
+   frame buffer itself is cleared by the block mover in the background
+   (see clearScreenPoll) and each line is shown again when it is first
+   drawn to.  Between deferBegin and deferEnd the line index changes,
+   and with them the clear moves, wait for the vertical blank.  */
+
 void
 clearScreen (uint8_t color)
 {
-  fillRectangle (0, 0, width(), height(), color);
+  const struct surface_t *fb = &m_picbuf[0].surf;
+  uint16_t i;
+
+  if (m_first_line_addr != fb->base || fb->height > MAX_PICLINES
+      || (m_clear_line == 0 && (m_clear_line = sramAlloc (fb->pitch)) == 0))
+    {
+      fillRectangle (0, 0, width(), height(), color);
+      return;
+    }
+
+  // A clear still in progress has to end before line 0 is reseeded.
+  clearFinish ();
+
+  SpiRamWriteBegin (m_clear_line);
+  for (i = 0; i < fb->pitch; i++)
+    spi_transfer (color);
+  SpiRamWriteEnd ();
+
+  damage (0, 0, fb->width, fb->height);
+  memset (m_clear_pending, 0xff, sizeof (m_clear_pending));
+  m_clear_lines = fb->height;
+
+  // Seed line 0 with one burst, the moves copy it downwards.
+  SpiRamWriteBegin (fb->base);
+  for (i = 0; i < fb->width; i++)
+    spi_transfer (color);
+  SpiRamWriteEnd ();
+  m_clear_x = fb->height > 1 ? 0 : fb->width;
+  m_clear_y = 0;
+  if (!deferred (clearIndexOp, 0, 0, indexBytes ()))
+    clearIndexOp (0, 0);
 }
 
 uint16_t piclinePitch(void)
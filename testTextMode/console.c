@@ -0,0 +1,521 @@
+#include <string.h>
+#include "vs23s0x0.h"
+#include "console.h"
+
+#define CON_CHAR_HEIGHT 8
+#define CON_MAX_COLS 42
+#define CON_MAX_ROWS 30
+#define CON_MAX_PARAMS 4
+#define CON_TAB_WIDTH 8
+
+/* Console glyphs are cached as glyph numbers from 256 on, apart from
+   the TMS9918 patterns.  */
+#define CON_GLYPH_BASE 0x100
+
+#define CON_DEFAULT_FG 7
+#define CON_DEFAULT_BG 0
+
+/* Escape sequence parser states.  */
+#define CON_TEXT 0
+#define CON_ESC 1
+#define CON_CSI 2
+
+/* YUV bytes of the TMS9918 colours closest to the 16 ANSI ones, see
+   colorLUT in tms9918.c.  */
+static const uint8_t conPalette[16] = {
+  0, 164, 21, 169, 84, 38, 90, 8,
+  8, 168, 24, 171, 70, 38, 90, 15
+};
+
+struct con_cell_t
+{
+  uint8_t ch;
+  uint8_t attr;			/* fg << 4 | bg */
+};
+
+/* The cells are kept by frame buffer row.  With hardware scrolling
+   the frame buffer is scrolled through the line index and console
+   row 0 is buffer row conTop; otherwise the buffer is not scrolled
+   and a scroll redraws all cells.  */
+static struct con_cell_t conCell[CON_MAX_ROWS][CON_MAX_COLS];
+static uint8_t conDirty[CON_MAX_ROWS][(CON_MAX_COLS + 7) / 8];
+static bool conRowDirty[CON_MAX_ROWS];
+
+static const uint8_t *conFont;
+static uint8_t conWidth;
+static uint8_t conCols;
+static uint8_t conRows;
+static uint16_t conLeft;
+static bool conHwScroll;
+static uint8_t conTop;
+static bool conScrolled;	/* conTop changed since the last flush */
+
+/* Cursor, conCol is conCols after the last column until the next
+   character wraps.  */
+static uint8_t conCol;
+static uint8_t conRow;
+static bool conCursorOn;
+static bool conCursorDrawn;
+static uint8_t conCursorBufRow;
+static uint8_t conCursorCol;
+
+static uint8_t conFg;
+static uint8_t conBg;
+static bool conBold;
+static bool conReverse;
+static uint8_t conAttr;
+
+static uint8_t conState;
+static uint8_t conParam[CON_MAX_PARAMS];
+static uint8_t conParams;
+static char conPrivate;		/* '<' to '?' leading the params, or 0 */
+static bool conIgnore;		/* intermediate bytes or ':' seen */
+
+static inline uint8_t
+conBufRow (uint8_t row)
+{
+  return (conTop + row) % conRows;
+}
+
+static inline void
+conMark (uint8_t bufRow, uint8_t col)
+{
+  conDirty[bufRow][col / 8] |= 1 << (col % 8);
+  conRowDirty[bufRow] = true;
+}
+
+static void
+conMarkAll (void)
+{
+  memset (conDirty, 0xff, sizeof (conDirty));
+  memset (conRowDirty, true, sizeof (conRowDirty));
+}
+
+/* Put CH into a cell in the current colours, it is only redrawn if
+   that changes it.  */
+static void
+conSet (uint8_t row, uint8_t col, uint8_t ch)
+{
+  uint8_t bufRow = conBufRow (row);
+  struct con_cell_t *cell = &conCell[bufRow][col];
+
+  if (cell->ch != ch || cell->attr != conAttr)
+    {
+      cell->ch = ch;
+      cell->attr = conAttr;
+      conMark (bufRow, col);
+    }
+}
+
+static void
+conErase (uint8_t row, uint8_t from, uint8_t to)
+{
+  for (; from < to; from++)
+    conSet (row, from, ' ');
+}
+
+static void
+conUpdateAttr (void)
+{
+  uint8_t fg = conFg | ((conBold && conFg < 8) ? 8 : 0);
+
+  conAttr = conReverse ? (conBg << 4 | fg) : (fg << 4 | conBg);
+}
+
+/* Scroll up by a row.  With hardware scrolling the row that scrolled
+   out becomes the bottom row, the line index follows on the next
+   flush.  */
+static void
+conScroll (void)
+{
+  conTop = (conTop + 1) % conRows;
+  if (conHwScroll)
+    conScrolled = true;
+  else
+    conMarkAll ();
+  conErase (conRows - 1, 0, conCols);
+}
+
+static void
+conNewline (void)
+{
+  conCol = 0;
+  if (conRow + 1 < conRows)
+    conRow++;
+  else
+    conScroll ();
+}
+
+static void
+conSgr (uint8_t p)
+{
+  if (p == 0)
+    {
+      conFg = CON_DEFAULT_FG;
+      conBg = CON_DEFAULT_BG;
+      conBold = false;
+      conReverse = false;
+    }
+  else if (p == 1)
+    conBold = true;
+  else if (p == 22)
+    conBold = false;
+  else if (p == 7)
+    conReverse = true;
+  else if (p == 27)
+    conReverse = false;
+  else if (p >= 30 && p <= 37)
+    conFg = p - 30;
+  else if (p == 39)
+    conFg = CON_DEFAULT_FG;
+  else if (p >= 40 && p <= 47)
+    conBg = p - 40;
+  else if (p == 49)
+    conBg = CON_DEFAULT_BG;
+  else if (p >= 90 && p <= 97)
+    conFg = p - 90 + 8;
+  else if (p >= 100 && p <= 107)
+    conBg = p - 100 + 8;
+  conUpdateAttr ();
+}
+
+/* Run the control sequence ESC [ params FINAL.  Of the private ones
+   only ESC [ ? 25 h and l, showing and hiding the cursor, are known;
+   others are ignored, as are those with intermediate bytes or
+   sub-parameters.  */
+static void
+conCsi (char final)
+{
+  uint8_t n = conParam[0] ? conParam[0] : 1;
+  uint8_t i;
+
+  if (conIgnore)
+    return;
+  if (conPrivate)
+    {
+      if (conPrivate == '?' && conParam[0] == 25
+	  && (final == 'h' || final == 'l'))
+	consoleShowCursor (final == 'h');
+      return;
+    }
+  if (conCol >= conCols)
+    conCol = conCols - 1;
+
+  switch (final)
+    {
+    case 'A':
+      conRow -= n < conRow ? n : conRow;
+      break;
+    case 'B':
+      conRow = (conRow + n < conRows) ? conRow + n : conRows - 1;
+      break;
+    case 'C':
+      conCol = (conCol + n < conCols) ? conCol + n : conCols - 1;
+      break;
+    case 'D':
+      conCol -= n < conCol ? n : conCol;
+      break;
+    case 'H':
+    case 'f':
+      consoleSetCursor (conParam[1] ? conParam[1] - 1 : 0,
+			conParam[0] ? conParam[0] - 1 : 0);
+      break;
+    case 'J':
+      if (conParam[0] == 2)
+	{
+	  for (i = 0; i < conRows; i++)
+	    conErase (i, 0, conCols);
+	  break;
+	}
+      if (conParam[0] == 1)
+	{
+	  for (i = 0; i < conRow; i++)
+	    conErase (i, 0, conCols);
+	  conErase (conRow, 0, conCol + 1);
+	  break;
+	}
+      conErase (conRow, conCol, conCols);
+      for (i = conRow + 1; i < conRows; i++)
+	conErase (i, 0, conCols);
+      break;
+    case 'K':
+      if (conParam[0] == 1)
+	conErase (conRow, 0, conCol + 1);
+      else
+	conErase (conRow, conParam[0] == 2 ? 0 : conCol, conCols);
+      break;
+    case 'm':
+      for (i = 0; i <= conParams; i++)
+	conSgr (conParam[i]);
+      break;
+    }
+}
+
+/* Function:  consoleBegin
+ * ----------------------------------------
+ * set up a text console on the frame buffer of the current mode,
+ * with the 256 glyphs of FONT, 8 bytes each, CHARWIDTH pixels wide
+ */
+bool
+consoleBegin (const uint8_t *font, uint8_t charWidth)
+{
+  if (charWidth == 0 || charWidth > 8 || height () < CON_CHAR_HEIGHT)
+    return false;
+
+  conFont = font;
+  conWidth = charWidth;
+  conCols = width () / charWidth;
+  if (conCols > CON_MAX_COLS)
+    conCols = CON_MAX_COLS;
+  conRows = height () / CON_CHAR_HEIGHT;
+  if (conRows > CON_MAX_ROWS)
+    conRows = CON_MAX_ROWS;
+  conLeft = (width () - conCols * charWidth) / 2;
+  /* The line index can only rotate the console rows if they are all
+     of the frame buffer.  */
+  conHwScroll = conRows * CON_CHAR_HEIGHT == height ();
+
+  setDrawSurface (NULL);
+  glyphCacheBegin (charWidth, CON_CHAR_HEIGHT, 256);
+
+  conState = CON_TEXT;
+  conCursorOn = true;
+  conSgr (0);
+  consoleClear ();
+  return true;
+}
+
+/* Function:  consoleEnd
+ * ----------------------------------------
+ * hand the frame buffer back unscrolled, for other drawing
+ */
+void
+consoleEnd (void)
+{
+  consoleFlush ();
+  if (conTop)
+    scrollPicBuffer (0, 0);
+  conTop = 0;
+}
+
+uint8_t
+consoleCols (void)
+{
+  return conCols;
+}
+
+uint8_t
+consoleRows (void)
+{
+  return conRows;
+}
+
+/* Function:  consoleClear
+ * ----------------------------------------
+ * clear the screen to the background colour and home the cursor
+ */
+void
+consoleClear (void)
+{
+  uint8_t row, col;
+
+  if (conTop)
+    scrollPicBuffer (0, 0);
+  conTop = 0;
+  conScrolled = false;
+  clearScreen (conPalette[conAttr & 0x0f]);
+
+  for (row = 0; row < conRows; row++)
+    for (col = 0; col < conCols; col++)
+      {
+	conCell[row][col].ch = ' ';
+	conCell[row][col].attr = conAttr;
+      }
+  memset (conDirty, 0, sizeof (conDirty));
+  memset (conRowDirty, 0, sizeof (conRowDirty));
+  conCursorDrawn = false;
+  conRow = 0;
+  conCol = 0;
+}
+
+/* Function:  consoleSetColors
+ * ----------------------------------------
+ * set the colours, ANSI colour numbers 0 to 15
+ */
+void
+consoleSetColors (uint8_t fg, uint8_t bg)
+{
+  conFg = fg & 0x0f;
+  conBg = bg & 0x0f;
+  conUpdateAttr ();
+}
+
+void
+consoleSetCursor (uint8_t col, uint8_t row)
+{
+  conCol = col < conCols ? col : conCols - 1;
+  conRow = row < conRows ? row : conRows - 1;
+}
+
+void
+consoleShowCursor (bool show)
+{
+  conCursorOn = show;
+}
+
+/* Function:  consolePutc
+ * ----------------------------------------
+ * write a character at the cursor, or run a control character or
+ * escape sequence; the screen is updated by consoleFlush
+ */
+void
+consolePutc (char c)
+{
+  uint8_t ch = c;
+
+  if (conState == CON_ESC)
+    {
+      conState = CON_TEXT;
+      if (ch == '[')
+	{
+	  memset (conParam, 0, sizeof (conParam));
+	  conParams = 0;
+	  conPrivate = 0;
+	  conIgnore = false;
+	  conState = CON_CSI;
+	}
+      return;
+    }
+  /* Parameter bytes are 0x30 to 0x3f, intermediate bytes 0x20 to 0x2f
+     and the final byte 0x40 to 0x7e.  Anything else cancels the
+     sequence and is taken as it is.  */
+  if (conState == CON_CSI && ch >= 0x20 && ch <= 0x7e)
+    {
+      if (ch >= '0' && ch <= '9' && !conIgnore)
+	{
+	  uint16_t p = conParam[conParams] * 10 + (ch - '0');
+	  conParam[conParams] = p > 255 ? 255 : p;
+	}
+      else if (ch == ';' && !conIgnore)
+	{
+	  if (conParams + 1 < CON_MAX_PARAMS)
+	    conParams++;
+	}
+      else if (ch >= '<' && ch <= '?' && !conIgnore)
+	{
+	  if (!conPrivate)
+	    conPrivate = ch;
+	}
+      else if (ch < 0x40)
+	conIgnore = true;
+      else
+	{
+	  conCsi (ch);
+	  conState = CON_TEXT;
+	}
+      return;
+    }
+  conState = CON_TEXT;
+
+  switch (ch)
+    {
+    case '\n':
+      conNewline ();
+      break;
+    case '\r':
+      conCol = 0;
+      break;
+    case '\b':
+      if (conCol >= conCols)
+	conCol = conCols - 1;
+      if (conCol)
+	conCol--;
+      break;
+    case '\t':
+      conCol = (conCol / CON_TAB_WIDTH + 1) * CON_TAB_WIDTH;
+      if (conCol > conCols)
+	conCol = conCols;
+      break;
+    case '\f':
+      consoleClear ();
+      break;
+    case 0x1b:
+      conState = CON_ESC;
+      break;
+    default:
+      if (ch < ' ')
+	break;
+      if (conCol >= conCols)
+	conNewline ();
+      conSet (conRow, conCol++, ch);
+      break;
+    }
+}
+
+void
+consoleWrite (const char *s, uint16_t n)
+{
+  while (n--)
+    consolePutc (*s++);
+  consoleFlush ();
+}
+
+void
+consolePrint (const char *s)
+{
+  consoleWrite (s, strlen (s));
+}
+
+static void
+conDrawCell (uint8_t row, uint8_t col, bool cursor)
+{
+  uint8_t bufRow = conBufRow (row);
+  const struct con_cell_t *cell = &conCell[bufRow][col];
+  uint8_t fg = conPalette[cell->attr >> 4];
+  uint8_t bg = conPalette[cell->attr & 0x0f];
+  uint16_t y = (conHwScroll ? bufRow : row) * CON_CHAR_HEIGHT;
+
+  drawGlyph (conLeft + col * conWidth, y, CON_GLYPH_BASE + cell->ch,
+	     conFont + cell->ch * CON_CHAR_HEIGHT, conWidth, CON_CHAR_HEIGHT,
+	     cursor ? bg : fg, cursor ? fg : bg);
+}
+
+/* Function:  consoleFlush
+ * ----------------------------------------
+ * move the line index to a new scroll position, then draw the cells
+ * that changed, each a glyph from the glyph cache; the rows freed by
+ * scrolling are only drawn once they are at the bottom
+ */
+void
+consoleFlush (void)
+{
+  uint8_t row, col;
+
+  if (conScrolled)
+    scrollPicBuffer (0, conTop * CON_CHAR_HEIGHT);
+  conScrolled = false;
+
+  if (conCursorDrawn)
+    conMark (conCursorBufRow, conCursorCol);
+
+  for (row = 0; row < conRows; row++)
+    {
+      uint8_t bufRow = conBufRow (row);
+
+      if (!conRowDirty[bufRow])
+	continue;
+      for (col = 0; col < conCols; col++)
+	if (conDirty[bufRow][col / 8] & (1 << (col % 8)))
+	  conDrawCell (row, col, false);
+      memset (conDirty[bufRow], 0, sizeof (conDirty[bufRow]));
+      conRowDirty[bufRow] = false;
+    }
+
+  conCursorDrawn = conCursorOn;
+  if (conCursorOn)
+    {
+      conCursorCol = conCol < conCols ? conCol : conCols - 1;
+      conCursorBufRow = conBufRow (conRow);
+      conDrawCell (conRow, conCursorCol, true);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#ifndef bool
+# include <stdbool.h>
+#endif
+
+bool consoleBegin(const uint8_t *font, uint8_t charWidth);
+void consoleEnd(void);
+uint8_t consoleCols(void);
+uint8_t consoleRows(void);
+void consoleClear(void);
+void consoleSetColors(uint8_t fg, uint8_t bg);
+void consoleSetCursor(uint8_t col, uint8_t row);
+void consoleShowCursor(bool show);
+void consolePutc(char c);
+void consoleWrite(const char *s, uint16_t n);
+void consolePrint(const char *s);
+void consoleFlush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
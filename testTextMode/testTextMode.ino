@@ -1,5 +1,6 @@
 #include "Arduino.h"
 #include "tms9918.h"
+#include "console.h"
 #include "font-6x8.h"
 #include "vs23s0x0-hal.h"
 #include <SPI.h>
@@ -108,6 +109,25 @@ void loop () {
   tms9918aWriteReg (7, 0xf6); /* White text on Light Blue Background.  */
   tms9918aDisplay ();
 
+  Serial.println(F("Next"));
+  delay(1);
+  while (Serial.available() == 0) {};
+  Serial.read();
+
+  /* Native console, it scrolls through the line index.  */
+  consoleBegin (console_font_6x8, 6);
+  consolePrint ("\x1b[1;33mVS23S0x0 console\x1b[0m\n");
+  for (uint16_t n = 0; Serial.available() == 0; n++)
+    {
+      char line[32];
+
+      snprintf (line, sizeof (line), "Line %u at %lu ms\n", n, millis ());
+      consolePrint (line);
+      delay (100);
+    }
+  Serial.read();
+  consoleEnd ();
+
   Serial.println(F("End of test! [Restart press key]"));
   delay(1);
   while (Serial.available() == 0) {};
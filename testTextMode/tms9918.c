@@ -1,3 +1,4 @@
+#include <string.h>
 #include "vs23s0x0.h"
 #include "tms9918.h"
 
@@ -90,6 +91,13 @@ static struct vrEmuTMS9918a_s
   uint32_t currentAddress; /* 16b address */
 
   vrEmuTms9918aMode mode;
+
+  /* Patterns written since they were last drawn, their glyphs in the
+     glyph cache are stale.  */
+  uint8_t patternDirty[256 / 8];
+
+  /* Pattern table the glyph cache was filled from.  */
+  uint32_t glyphTable;
 } tms9918a;
 
 
@@ -161,43 +169,97 @@ tmsMainFgColor (void)
   return c == TMS_TRANSPARENT ? tmsMainBgColor() : c;
 }
 
+/* Function:  tmsGlyphCacheSync
+ * ----------------------------------------
+ * set up the glyph cache for characters WIDTH pixels wide and forget
+ * the patterns that changed
+ */
+static void
+tmsGlyphCacheSync (uint8_t width)
+{
+  if (!glyphCacheBegin (width, ANY_CHAR_HEIGHT, 256))
+    return;
+
+  if (tms9918a.glyphTable != tmsPatternTableAddr ())
+    {
+      glyphCacheClear ();
+      tms9918a.glyphTable = tmsPatternTableAddr ();
+    }
+  else
+    for (int i = 0; i < 256; i++)
+      if (tms9918a.patternDirty[i / 8] & (1 << (i % 8)))
+	glyphCacheForget (i);
+
+  memset (tms9918a.patternDirty, 0, sizeof (tms9918a.patternDirty));
+}
+
+/* Function:  tmsFillBg
+ * ----------------------------------------
+ * fill W x H pixels from (X, Y) on with COLOR, with the block mover if
+ * fillRectangle can take the block
+ */
+static void
+tmsFillBg (uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t color)
+{
+  if (w >= 8 && h >= 2)
+    fillRectangle (x, y, x + w, y + h, color);
+  else
+    while (h--)
+      drawHSpan (x, y++, w, color);
+}
+
 /* Function:  tms9918aTextMode
  * ----------------------------------------
  * generate a full Text mode screen
  */
 
 static void
-tms9918aTextMode (void)
+tms9918aTextLine (uint16_t y)
 {
-  vrEmuTms9918aColor bgColor = tmsMainBgColor ();
-  vrEmuTms9918aColor fgColor = tmsMainFgColor ();
+  uint8_t fgColor = colorLUT[tmsMainFgColor ()];
+  uint8_t bgColor = colorLUT[tmsMainBgColor ()];
+  int textRow = y / 8;
+  uint32_t namesAddr = tmsNameTableAddr() + textRow * TEXT_NUM_COLS;
+  const uint16_t right = 8 + TEXT_NUM_COLS * TEXT_CHAR_WIDTH;
+  uint16_t top = textRow * ANY_CHAR_HEIGHT;
+
+  /* The background below the text is painted line by line here
+     rather than by clearing the screen ahead of the beam.  */
+  if (textRow >= TEXT_NUM_ROWS)
+    {
+      drawHSpan (0, y, width (), bgColor);
+      return;
+    }
 
-  //FIXME Set BG
-  clearScreen (colorLUT[bgColor]);
-  for (uint16_t y = 0;  y < height(); y++)
+  /* A character row is drawn once the beam has passed its last line,
+     a glyph per character, and the margins left and right of it as
+     one block each.  */
+  if (y % 8 != 7 && y != height () - 1)
+    return;
+
+  tmsFillBg (0, top, 8, y - top + 1, bgColor);
+  if (width () > right)
+    tmsFillBg (right, top, width () - right, y - top + 1, bgColor);
+
+  for (uint16_t tileX = 0; tileX < TEXT_NUM_COLS; tileX++) //x.vs23.width()
     {
-      int textRow = y / 8;
-      int patternRow = y % 8;
-      uint32_t namesAddr = tmsNameTableAddr() + textRow * TEXT_NUM_COLS;
+      uint8_t pattern = tms9918a.vram[namesAddr + tileX];
 
-      for (uint16_t tileX = 0; tileX < TEXT_NUM_COLS; tileX++) //x.vs23.width()
-	{
-	  uint8_t pattern = tms9918a.vram[namesAddr + tileX];
-	  uint8_t patternByte = tms9918a.vram[tmsPatternTableAddr() +
-					      pattern * 8 + patternRow];
-
-	  for (int i = 0; i < TEXT_CHAR_WIDTH; i++)
-	    {
-	      //EXTEND: Each Char has it's own BG & effects.
-	      if (patternByte & 0x80) // BG is set globaly
-		setPixelYuv (tileX * TEXT_CHAR_WIDTH + i + 8, y,
-			     colorLUT[fgColor]);
-	      patternByte <<= 1;
-	    }
-	}
+      //EXTEND: Each Char has it's own BG & effects.
+      drawGlyph (tileX * TEXT_CHAR_WIDTH + 8, top,
+		 pattern, &tms9918a.vram[tmsPatternTableAddr() + pattern * 8],
+		 TEXT_CHAR_WIDTH, ANY_CHAR_HEIGHT, fgColor, bgColor);
     }
 }
 
+static void
+tms9918aTextMode (void)
+{
+  tmsGlyphCacheSync (TEXT_CHAR_WIDTH);
+  // Draw each line behind the beam, so it is not torn on screen.
+  chaseBeam (0, height (), tms9918aTextLine);
+}
+
 static void
 tms99918aTextUpdate (uint8_t pattern, uint8_t patternRow, bool updateChar)
 {
@@ -278,6 +340,13 @@ tms9918aWriteData (uint8_t data)
 {
   tms9918a.vram[tms9918a.currentAddress] = data;
 
+  if (tms9918a.currentAddress >= tmsPatternTableAddr()
+      && tms9918a.currentAddress < tmsPatternTableAddr() + 256 * 8)
+    {
+      uint8_t pattern = (tms9918a.currentAddress - tmsPatternTableAddr()) / 8;
+      tms9918a.patternDirty[pattern / 8] |= 1 << (pattern % 8);
+    }
+
 #if 0
   /* 1. Check if we change a Name table entry.  Update the given
      address.  */
@@ -296,6 +365,7 @@ tms9918aWriteData (uint8_t data)
 void
 tms9918aDisplay (void)
 {
+  waitVideoReady ();
   switch (tms9918a.mode)
     {
     case TMS_MODE_GRAPHICS_I:
@@ -4,33 +4,98 @@
 /// Crystal frequency in MHZ (float, observe accuracy)
 #define XTAL_MHZ_NTSC 3.579545
 #define XTAL_MHZ_PAL 4.43361875
-#define XTAL_MHZ (m_pal ? XTAL_MHZ_PAL : XTAL_MHZ_NTSC)
 
 /// Line length in microseconds (float, observe accuracy)
 #define LINE_LENGTH_US_NTSC 63.5555
 #define LINE_LENGTH_US_PAL 64.0
-#define LINE_LENGTH_US (m_pal ? LINE_LENGTH_US_PAL : LINE_LENGTH_US_NTSC)
 
 /// Frame length in lines (visible lines + nonvisible lines)
 /// Amount has to be odd for NTSC and RGB colors
 #define TOTAL_LINES_INTERLACE_NTSC 525
 #define TOTAL_LINES_INTERLACE_PAL 625
-#define TOTAL_LINES_INTERLACE (m_pal ? TOTAL_LINES_INTERLACE_PAL : TOTAL_LINES_INTERLACE_NTSC)
 
 #define FIELD1START_NTSC 261
 #define FIELD1START_PAL 310
-#define FIELD1START (m_pal ? FIELD1START_PAL : FIELD1START_NTSC)
 
 #define TOTAL_LINES_PROGRESSIVE_NTSC 262
 #define TOTAL_LINES_PROGRESSIVE_PAL 313	// or 312?
-#define TOTAL_LINES_PROGRESSIVE (m_pal ? TOTAL_LINES_PROGRESSIVE_PAL : TOTAL_LINES_PROGRESSIVE_NTSC)
-
-#define TOTAL_LINES (m_interlace ? TOTAL_LINES_INTERLACE : TOTAL_LINES_PROGRESSIVE)
 
 /// Number of lines used after the VSYNC but before visible area.
 #define FRONT_PORCH_LINES_NTSC 20
 #define FRONT_PORCH_LINES_PAL 22
-#define FRONT_PORCH_LINES (m_pal ? FRONT_PORCH_LINES_PAL : FRONT_PORCH_LINES_NTSC)
+
+/// Reserve memory for this number of different prototype lines
+/// (prototype lines are used for sync timing, porch and border area)
+#define PROTOLINES_INTERLACE 8
+#define PROTOLINES_PROGRESSIVE 4
+
+/// Define NTSC video timing constants
+/// NTSC short sync duration is 2.35 us
+#define SHORT_SYNC_US_NTSC 2.542
+#define SHORT_SYNC_US_PAL 2.35
+/// NTSC long sync duration is 27.3 us
+#define LONG_SYNC_US_NTSC 27.33275
+#define LONG_SYNC_US_PAL 27.3
+/// Normal visible picture line sync length is 4.7 us
+#define SYNC_US 4.7
+/// Color burst starts at 5.6 us
+#define BURST_US_NTSC 5.3
+#define BURST_US_PAL 5.6
+/// Color burst duration is 2.25 us
+#define BURST_DUR_US_NTSC 2.67
+#define BURST_DUR_US_PAL 2.25
+/// NTSC sync to blanking end time is 10.5 us
+#define BLANK_END_US_NTSC 9.155
+#define BLANK_END_US_PAL 10.5
+/// Front porch starts at the end of the line, at 62.5us
+#define FRPORCH_US_NTSC 61.8105
+#define FRPORCH_US_PAL 62.5
+
+/// Timings of system SYS (NTSC or PAL) in integer units.  These are
+/// constant expressions, the floating point math is done by the
+/// compiler.
+/// Protoline lenght is the real lenght of protoline (optimal memory
+/// layout, but visible lines' prototype must always be proto 0)
+#define T_PROTOLINE_LENGTH_WORDS(sys) \
+  ((uint16_t)(LINE_LENGTH_US_##sys*XTAL_MHZ_##sys+0.5))
+/// 10 first pllclks, which are not in the counters are decremented here
+#define T_PLLCLKS_PER_LINE(sys) \
+  ((uint16_t)((LINE_LENGTH_US_##sys * (XTAL_MHZ_##sys * 8.0))+0.5-10))
+#define T_COLORCLKS_PER_LINE(sys) \
+  ((uint16_t)((LINE_LENGTH_US_##sys * XTAL_MHZ_##sys)+0.5-10.0/8.0))
+#define T_COLORCLKS_LINE_HALF(sys) \
+  ((uint16_t)((LINE_LENGTH_US_##sys * XTAL_MHZ_##sys)/2+0.5-10.0/8.0))
+/// For the start of the line, the first 10 extra PLLCLK sync (0) cycles
+/// are subtracted.
+#define T_SHORTSYNC(sys) ((uint16_t)(SHORT_SYNC_US_##sys*XTAL_MHZ_##sys-10.0/8.0))
+/// For the middle of the line the whole duration of sync pulse is used.
+#define T_SHORTSYNCM(sys) ((uint16_t)(SHORT_SYNC_US_##sys*XTAL_MHZ_##sys))
+#define T_LONGSYNC(sys) ((uint16_t)(LONG_SYNC_US_##sys*XTAL_MHZ_##sys))
+#define T_LONGSYNCM(sys) ((uint16_t)(LONG_SYNC_US_##sys*XTAL_MHZ_##sys))
+#define T_SYNC(sys) ((uint16_t)(SYNC_US*XTAL_MHZ_##sys-10.0/8.0))
+#define T_BURST(sys) ((uint16_t)(BURST_US_##sys*XTAL_MHZ_##sys-10.0/8.0))
+#define T_BURSTDUR(sys) ((uint16_t)(BURST_DUR_US_##sys*XTAL_MHZ_##sys))
+#define T_BLANKEND(sys) ((uint16_t)(BLANK_END_US_##sys*XTAL_MHZ_##sys-10.0/8.0))
+#define T_FRPORCH(sys) ((uint16_t)(FRPORCH_US_##sys*XTAL_MHZ_##sys-10.0/8.0))
+
+/// Initializer of the video_timing_t of system SYS, TYPE is INTERLACE
+/// or PROGRESSIVE.
+#define VIDEO_TIMING(sys, type) {			\
+    T_PLLCLKS_PER_LINE(sys), T_COLORCLKS_PER_LINE(sys),	\
+    T_COLORCLKS_LINE_HALF(sys), T_PROTOLINE_LENGTH_WORDS(sys),	\
+    PROTOLINES_##type, TOTAL_LINES_##type##_##sys,	\
+    FIELD1START_##sys, FRONT_PORCH_LINES_##sys,		\
+    T_SHORTSYNC(sys), T_SHORTSYNCM(sys),			\
+    T_LONGSYNC(sys), T_LONGSYNCM(sys), T_SYNC(sys),	\
+    T_BURST(sys), T_BURSTDUR(sys), T_BLANKEND(sys), T_FRPORCH(sys),	\
+    (uint16_t)(LINE_LENGTH_US_##sys*1000+0.5) }
+
+/// Timings of the current system, see vs23_timing in vs23s0x0.c.
+#define TIMING (vs23_timing[m_pal][m_interlace])
+
+#define TOTAL_LINES (TIMING.total_lines)
+#define FIELD1START (TIMING.field1start)
+#define FRONT_PORCH_LINES (TIMING.front_porch_lines)
 
 /// Width, in PLL clocks, of each pixel
 /// Used 4 to 8 for 160x120 pics
@@ -45,82 +110,54 @@
 /// On which line the picture area begins, the Y direction.
 //#define STARTLINE ((uint16_t)(TOTAL_LINES/4))
 #define STARTLINE (FRONT_PORCH_LINES+m_current_mode->top)
+/// Field 1 of interlaced PAL has two more lines before the picture, the
+/// lowest top a mode can have.
+#define MIN_TOP ((m_pal && m_interlace) ? 2 : 0)
+/// 2 if the fields of an interlaced mode show alternate picture lines,
+/// even ones in field 0 and odd ones in field 1.
+#define PICFIELDS (m_current_mode->fieldlines ? 2 : 1)
+/// Number of scan lines showing the picture, each picture line is
+/// repeated LINEREP times.  Both fields together if PICFIELDS is 2.
+#define PICSCANS (YPIXELS * LINEREP)
+/// Number of scan lines showing the picture in a field.
+#define SCANLINES (PICSCANS / PICFIELDS)
 /// The last picture area line
-#define ENDLINE STARTLINE + YPIXELS
+#define ENDLINE STARTLINE + SCANLINES
 /// The first pixel of the picture area, the X direction.
 #define STARTPIX (BLANKEND + m_current_mode->left)
 /// The last pixel of the picture area. Set PIXELS to wanted value and suitable
 /// ENDPIX value is calculated.
 #define ENDPIX ((uint16_t)(STARTPIX + PLLCLKS_PER_PIXEL * XPIXELS/8))
 
-/// Reserve memory for this number of different prototype lines
-/// (prototype lines are used for sync timing, porch and border area)
-#define PROTOLINES_INTERLACE 8
-#define PROTOLINES_PROGRESSIVE 4
-#define PROTOLINES (m_interlace ? PROTOLINES_INTERLACE : PROTOLINES_PROGRESSIVE)
-
-/// Protoline lenght is the real lenght of protoline (optimal memory
-/// layout, but visible lines' prototype must always be proto 0)
-#define PROTOLINE_LENGTH_WORDS ((uint16_t)(LINE_LENGTH_US*XTAL_MHZ+0.5))
+#define PROTOLINES (TIMING.protolines)
+#define PROTOLINE_LENGTH_WORDS (TIMING.protoline_length_words)
 
-/// PLL frequency
-#define PLL_MHZ (XTAL_MHZ * 8.0)
-/// 10 first pllclks, which are not in the counters are decremented here
-#define PLLCLKS_PER_LINE ((uint16_t)((LINE_LENGTH_US * PLL_MHZ)+0.5-10))
-/// 10 first pllclks, which are not in the counters are decremented here
-#define COLORCLKS_PER_LINE ((uint16_t)((LINE_LENGTH_US * XTAL_MHZ)+0.5-10.0/8.0))
-#define COLORCLKS_LINE_HALF ((uint16_t)((LINE_LENGTH_US * XTAL_MHZ)/2+0.5-10.0/8.0))
+#define PLLCLKS_PER_LINE (TIMING.pllclks_per_line)
+#define COLORCLKS_PER_LINE (TIMING.colorclks_per_line)
+#define COLORCLKS_LINE_HALF (TIMING.colorclks_line_half)
 
 #define PROTO_AREA_WORDS (PROTOLINE_LENGTH_WORDS * PROTOLINES)
 #define INDEX_START_LONGWORDS ((PROTO_AREA_WORDS+1)/2)
 #define INDEX_START_WORDS (INDEX_START_LONGWORDS * 2)
 #define INDEX_START_BYTES (INDEX_START_WORDS * 2)
 
-/// Define NTSC video timing constants
-/// NTSC short sync duration is 2.35 us
-#define SHORT_SYNC_US_NTSC 2.542
-#define SHORT_SYNC_US_PAL 2.35
-#define SHORT_SYNC_US (m_pal ? SHORT_SYNC_US_PAL : SHORT_SYNC_US_NTSC)
-
-/// For the start of the line, the first 10 extra PLLCLK sync (0) cycles
-/// are subtracted.
-#define SHORTSYNC ((uint16_t)(SHORT_SYNC_US*XTAL_MHZ-10.0/8.0))
-/// For the middle of the line the whole duration of sync pulse is used.
-#define SHORTSYNCM ((uint16_t)(SHORT_SYNC_US*XTAL_MHZ))
-/// NTSC long sync duration is 27.3 us
-#define LONG_SYNC_US_NTSC 27.33275
-#define LONG_SYNC_US_PAL 27.3
-#define LONG_SYNC_US (m_pal ? LONG_SYNC_US_PAL : LONG_SYNC_US_NTSC)
-
-#define LONGSYNC ((uint16_t)(LONG_SYNC_US*XTAL_MHZ))
-#define LONGSYNCM ((uint16_t)(LONG_SYNC_US*XTAL_MHZ))
-/// Normal visible picture line sync length is 4.7 us
-#define SYNC_US 4.7
-#define SYNC ((uint16_t)(SYNC_US*XTAL_MHZ-10.0/8.0))
-/// Color burst starts at 5.6 us
-#define BURST_US_NTSC 5.3
-#define BURST_US_PAL 5.6
-#define BURST_US (m_pal ? BURST_US_PAL : BURST_US_NTSC)
-
-#define BURST ((uint16_t)(BURST_US*XTAL_MHZ-10.0/8.0))
-/// Color burst duration is 2.25 us
-#define BURST_DUR_US_NTSC 2.67
-#define BURST_DUR_US_PAL 2.25
-#define BURST_DUR_US (m_pal ? BURST_DUR_US_PAL : BURST_DUR_US_NTSC)
-
-#define BURSTDUR ((uint16_t)(BURST_DUR_US*XTAL_MHZ))
-/// NTSC sync to blanking end time is 10.5 us
-#define BLANK_END_US_NTSC 9.155
-#define BLANK_END_US_PAL 10.5
-#define BLANK_END_US (m_pal ? BLANK_END_US_PAL : BLANK_END_US_NTSC)
+#define SHORTSYNC (TIMING.shortsync)
+#define SHORTSYNCM (TIMING.shortsyncm)
+#define LONGSYNC (TIMING.longsync)
+#define LONGSYNCM (TIMING.longsyncm)
+#define SYNC (TIMING.sync)
+#define BURST (TIMING.burst)
+#define BURSTDUR (TIMING.burstdur)
+#define BLANKEND (TIMING.blankend)
+#define FRPORCH (TIMING.frporch)
+#define LINE_LENGTH_NS (TIMING.line_ns)
 
-#define BLANKEND ((uint16_t)(BLANK_END_US*XTAL_MHZ-10.0/8.0))
-/// Front porch starts at the end of the line, at 62.5us
-#define FRPORCH_US_NTSC 61.8105
-#define FRPORCH_US_PAL 62.5
-#define FRPORCH_US (m_pal ? FRPORCH_US_PAL : FRPORCH_US_NTSC)
+/// Most runs of level in a prebuilt protoline image
+#define PROTO_RUNS 7
 
-#define FRPORCH ((uint16_t)(FRPORCH_US*XTAL_MHZ-10.0/8.0))
+/// The picture line microcode shows one byte per pixel, see setColorSpace,
+/// so picture lines are sized for 8-bit wide pixels.
+#define BYTEPIC
 
 /// Select U, V and Y bit widths for 16-bit or 8-bit wide pixels.
 #ifndef BYTEPIC
@@ -153,7 +190,74 @@
 #define PICLINE_WORD_ADDRESS(n) (PICLINE_START/2+(PICLINE_LENGTH_BYTES/2+BEXTRA/2)*(n))
 #define PICLINE_BYTE_ADDRESS(n) ((uint32_t)(PICLINE_START+((uint32_t)(PICLINE_LENGTH_BYTES)+BEXTRA)*(n)))
 
-#define PICLINE_MAX ((131072-PICLINE_START)/(PICLINE_LENGTH_BYTES+BEXTRA))
+/// Size of the VS23S010 SRAM in bytes
+#define SRAM_SIZE 131072
+
+#define PICLINE_MAX ((SRAM_SIZE-PICLINE_START)/(PICLINE_LENGTH_BYTES+BEXTRA))
+
+/// VS23 ICs on one SPI bus and chip select, told apart by the
+/// multi-IC register; the VS23S040 has four in one package
+#define MAX_CHANNELS 4
+#define ALL_CHANNELS ((1 << MAX_CHANNELS) - 1)
+/// Bytes sramCopy moves per read and write burst
+#define SRAM_COPY_CHUNK 32
+
+/// Shortest drawVSpan that is drawn with the block mover, shorter ones
+/// are cheaper as single pixel writes
+#define VSPAN_MOVE_MIN 4
+
+/// Pixels drawBitmap converts at a time
+#define BITMAP_CHUNK 32
+
+/// Number of off-screen SRAM blocks that can be allocated at a time
+#define MAX_SRAM_BLOCKS 16
+
+/// Glyphs the glyph cache can hold, and its hash buckets as a power
+/// of two
+#define MAX_GLYPH_SLOTS 256
+#define GLYPH_HASH_BITS 6
+/// Widest glyph, one byte of bits per glyph line
+#define GLYPH_MAX_WIDTH 8
+
+/// Smallest block, in pixels across and lines, that the geometry
+/// functions fill with the block mover, see fillBlock
+#define FILL_MOVE_MIN_WIDTH 16
+#define FILL_MOVE_MIN_LINES 4
+/// Most polygon edges fillPolygon takes to cross one line
+#define MAX_POLY_CROSSINGS 32
+
+/// Damaged rectangles the dirty tracker keeps apart, see dirtyAdd
+#define MAX_DIRTY_RECTS 16
+/// Repaint cost model defaults, until dirtyBegin has timed them: the
+/// overhead of a write transaction, a byte in a write burst, the
+/// overhead of a block move and a byte the block mover copies
+#define DIRTY_WRITE_NS 10000
+#define DIRTY_BYTE_NS 2000
+#define DIRTY_MOVE_NS 30000
+#define DIRTY_MOVE_BYTE_NS 250
+/// Slowest byte time the cost model takes, so that costs fit 32 bits
+#define DIRTY_BYTE_NS_MAX 4095
+/// Bytes written and moved, and single byte moves, to time the
+/// transactions
+#define DIRTY_CAL_BYTES 128
+#define DIRTY_CAL_MOVES 8
+
+/// Most picture lines a frame buffer can have
+#define MAX_PICLINES 640
+
+/// How often the beam prediction is checked against CURLINE
+#define BEAM_CHECK_US 50000
+/// Prediction error in lines that makes the beam predictor re-sync
+#define BEAM_DRIFT_LINES 2
+
+/// Updates that can wait in the deferred queue at a time, and the
+/// largest group: enough to rebind every band, scroll every picture
+/// buffer and set border and colour space in one blank
+#define MAX_DEFERRED 16
+/// SPI time per byte assumed until the deferred queue has measured it
+#define DEFER_BYTE_NS 2000
+/// Picture lines a deferred update waits for the vertical blank
+#define DEFER_WAIT_LINES 16
 
 /// 8-bit RGB to 8-bit YUV444 conversion
 #define YRGB(r,g,b) ((76*r+150*g+29*b)>>8)
@@ -181,6 +285,7 @@
 #define WRITE_MULTIIC 0xb8
 #define WRITE_GPIO_CTRL 0x82
 #define WRITE_SRAM 0x02
+#define READ_SRAM 0x03
 
 /// Bit definitions
 #define VDCTRL1 0x2B